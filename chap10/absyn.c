@@ -3,6 +3,7 @@
  *           abstract syntax rule.
  */
 
+#include <stddef.h>
 #include "util.h"
 #include "symbol.h" /* symbol table data structures */
 #include "absyn.h"  /* abstract syntax data structures */
@@ -249,6 +250,16 @@ A_fundec A_Fundec(A_pos pos, S_symbol name, A_fieldList params, S_symbol result,
     p->params = params;
     p->result = result;
     p->body = body;
+    p->static_link = TRUE;
+    p->captured = NULL;
+    p->used = TRUE;
+    return p;
+}
+
+A_symbolList A_SymbolList(S_symbol head, A_symbolList tail) {
+    A_symbolList p = checked_malloc(sizeof(*p));
+    p->head = head;
+    p->tail = tail;
     return p;
 }
 
@@ -25,6 +25,7 @@ typedef struct A_field_ *A_field;
 typedef struct A_fieldList_ *A_fieldList;
 typedef struct A_fundec_ *A_fundec;
 typedef struct A_fundecList_ *A_fundecList;
+typedef struct A_symbolList_ *A_symbolList;
 typedef struct A_namety_ *A_namety;
 typedef struct A_nametyList_ *A_nametyList;
 typedef struct A_efield_ *A_efield;
@@ -157,6 +158,14 @@ struct A_fundec_ {
     A_fieldList params;
     S_symbol result;
     A_exp body;
+    bool static_link;       // Set by escape analysis: FALSE if the function needs no static link
+    A_symbolList captured;  // Outer variables passed as extra arguments instead
+    bool used;              // Set by escape analysis: FALSE if the function is never called
+};
+
+struct A_symbolList_ {
+    S_symbol head;
+    A_symbolList tail;
 };
 
 struct A_fundecList_ {
@@ -243,6 +252,8 @@ A_expList A_ExpList(A_exp head, A_expList tail);
 A_fundec A_Fundec(A_pos pos, S_symbol name, A_fieldList params, S_symbol result,
                   A_exp body);
 
+A_symbolList A_SymbolList(S_symbol head, A_symbolList tail);
+
 A_fundecList A_FundecList(A_fundec head, A_fundecList tail);
 
 A_decList A_DecList(A_dec head, A_decList tail);
@@ -4,381 +4,270 @@
 
 /*
  * MIPS code generator
- * Pattern definitions
  *
- * MIPS Instr               Tiger IR                                    Cost
- *
- * addi rt, zero, imm       CONST(i)                                    1
- * (... save args ...)      CALL(e,args)                                1
- * jalr rs, ra
- * (... save args ...)      CALL(NAME l, args)                          1
- * jal label
- * la rd, label             NAME(l)                                     1
- * /                        TEMP(t)                                     0
- * /                        EXP(e)                                      0
- * add rd, rs, rt           BINOP(PLUS,e1,e2)                           1
- * addi rt, rs, imm         BINOP(PLUS,e1,const)                        1
- * addi rt, rs, imm         BINOP(PLUS,const,e1)                        1
- * sub rd, rs, rt           BINOP(MINUS,e1,e2)                          1
- * subi rt, rs, imm         BINOP(MINUS,e1,const)                       1
- * div rs, rt               BINOP(DIV,e1,e2)                            1
- * mult rs, rt              BINOP(MUL,e1,e2)                            1
- * beq rs, rt, label        CJUMP(EQ,e1,e2,NAME l1)                     1
- * bne rs, rt, label        CJUMP(NE,e1,e2,NAME l1)                     1
- * slt at, rs, rt           CJUMP(LT,e1,e2,NAME l1)                     1
- * bne at, zero, label
- * slt at, rs, rt           CJUMP(GE,e1,e2,NAME l1)                     1
- * beq at, zero, label
- * slt at, rt, rs           CJUMP(GT,e1,e2,NAME l1)                     1
- * bne at, zero, label
- * slt at, rt, rs           CJUMP(LE,e1,e2,NAME l1)                     1
- * beq at, zero, label
- * bgez rs, label           CJUMP(GE,e1,const 0,NAME l1)                1
- * bgtz rs, label           CJUMP(GT,e1,const 0,NAME l1)                1
- * blez rs, label           CJUMP(LE,e1,const 0,NAME l1)                1
- * bltz rs, label           CJUMP(LT,e1,const 0,NAME l1)                1
- * jr rs                    JUMP(e)                                     1
- * j label                  JUMP(NAME l1)                               1
- * lw rt, off(rs)           MEM(BINOP(PLUS,e1,CONST))                   1
- * lw rt, off(rs)           MEM(BINOP(PLUS,CONST,e1))                   1
- * lw rt, 0(rs)             MEM(e1)                                     1
- * add rt, rs, zero         MOVE(TEMP,e)                        Move    1
- * label:                   LABEL l1                            Label   1
- * sw rt, off(rs)           MOVE(MEM(BINOP(PLUS,e1,const)),e)           1
- * sw rt, off(rs)           MOVE(MEM(BINOP(PLUS,const,e1)),e)           1
- * sw rt, 0(rs)             MOVE(MEM(e1),e)                             1
+ * The patterns and their costs are in mips.brg; the labeller generated from it
+ * by tools/burg is included at the end. Rule Name is emitted by genName below.
  */
 
-static T_expList matchConst(T_exp exp, bool* matched) {
-    if (exp->kind == T_CONST) {
-        *matched = TRUE;
-        return NULL;
-    }
-    return NULL;
+// Predicates on constants used by the patterns
+static bool isZero(int n) {
+    return n == 0;
 }
 
-static T_expList matchCall(T_exp exp, bool* matched) {
-    if (exp->kind == T_CALL) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.CALL.fun, exp->u.CALL.args);
-    }
-    return NULL;
+static bool isImm16(int n) {
+    return n >= -32768 && n <= 32767;
 }
 
-static T_expList matchNamedCall(T_exp exp, bool* matched) {
-    if (exp->kind == T_CALL && exp->u.CALL.fun->kind == T_NAME) {
-        *matched = TRUE;
-        return exp->u.CALL.args;
-    }
-    return NULL;
+static bool isUImm16(int n) {
+    return n >= 0 && n <= 65535;
 }
 
-static T_expList matchName(T_exp exp, bool* matched) {
-    if (exp->kind == T_NAME) {
-        *matched = TRUE;
-        return NULL;
-    }
-    return NULL;
+static bool isNegImm16(int n) {
+    return n > -32768 && n <= 32768;
 }
 
-static T_expList matchTemp(T_exp exp, bool* matched) {
-    if (exp->kind == T_TEMP) {
-        *matched = TRUE;
-        return NULL;
-    }
-    return NULL;
+static bool isImm16Succ(int n) {
+    return n >= -32769 && n < 32767;
 }
 
-static T_expList matchExp(T_stm stm, bool* matched) {
-    if (stm->kind == T_EXP) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.EXP, NULL);
-    }
-    return NULL;
-}
-
-static T_expList matchBinopPlus(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_plus) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.left, T_ExpList(exp->u.BINOP.right, NULL));
-    }
-    return NULL;
-}
-
-static T_expList matchBinopPlusImmEC(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_plus && exp->u.BINOP.right->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.left, NULL);
-    }
-    return NULL;
+static bool isShamt(int n) {
+    return n >= 0 && n < 32;
 }
 
-static T_expList matchBinopPlusImmCE(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_plus && exp->u.BINOP.left->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.right, NULL);
-    }
-    return NULL;
+static bool isPow2(int n) {
+    return n > 1 && (n & (n - 1)) == 0;
 }
 
-static T_expList matchBinopMinus(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_minus) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.left, T_ExpList(exp->u.BINOP.right, NULL));
+static int exactLog2(int n) {
+    int k = 0;
+    while (n > 1) {
+        n >>= 1;
+        k++;
     }
-    return NULL;
+    return k;
 }
 
-static T_expList matchBinopMinusImm(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_minus && exp->u.BINOP.right->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.left, NULL);
-    }
-    return NULL;
+// Divisors done by multiplying with a magic number (see magic below)
+static bool isMagic(int n) {
+    return n > 2 && !isPow2(n);
 }
 
-static T_expList matchBinopDiv(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_div) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.left, T_ExpList(exp->u.BINOP.right, NULL));
-    }
-    return NULL;
+Temp_tempList L(Temp_temp h, Temp_tempList t) {
+    return Temp_TempList(h, t);
 }
 
-static T_expList matchBinopMul(T_exp exp, bool* matched) {
-    if (exp->kind == T_BINOP && exp->u.BINOP.op == T_mul) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.BINOP.left, T_ExpList(exp->u.BINOP.right, NULL));
+static void genFrameArg(T_expList args, int off) {
+    if (!args) {
+        if (off) {
+            // Reserve stack space
+            F_emit(AS_OperImm(AS_ADDIU, L(F_SP(), NULL), L(F_SP(), NULL), -off));
+        }
+        return;
     }
-    return NULL;
-}
 
-static T_expList matchBinopCjumpEq(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_eq) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
-    }
-    return NULL;
-}
+    genFrameArg(args->tail, off + F_wordSize);
 
-static T_expList matchBinopCjumpNe(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_ne) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
-    }
-    return NULL;
+    // Well, args suck
+    F_emit(AS_OperImm(AS_SW, NULL, L(F_doExp(args->head), L(F_SP(), NULL)), off));
 }
 
-static T_expList matchBinopCjumpLt(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_lt) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
+static void genArg(T_expList args) {
+    for (Temp_tempList argregs = F_Argregs(); args && argregs; argregs = argregs->tail) {
+        F_emit(AS_Oper(AS_ADD, L(argregs->head, NULL), L(F_doExp(args->head), L(F_ZERO(), NULL)), NULL));
+        args = args->tail;
     }
-    return NULL;
-}
-
-static T_expList matchBinopCjumpGt(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_gt) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
+    if (args) {
+        genFrameArg(args, 0);
     }
-    return NULL;
 }
 
-static T_expList matchBinopCjumpLe(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_le) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
+/*
+ * Arguments of a tail call overwrite the incoming arguments of the caller:
+ * register arguments go to the argument registers, and the others to the
+ * incoming argument area above the frame pointer (see F_frameFits), at the
+ * offsets a normal call gives them from the stack pointer (genFrameArg). All of
+ * them are computed first, since an argument may read an incoming one that an
+ * earlier store would overwrite.
+ * Return the argument registers used, followed by live.
+ */
+static Temp_tempList genTailArg(T_expList args, Temp_tempList live) {
+    Temp_tempList values = NULL, last = NULL;
+    for (; args; args = args->tail) {
+        Temp_tempList node = L(F_doExp(args->head), NULL);
+        if (last) {
+            last->tail = node;
+        } else {
+            values = node;
+        }
+        last = node;
     }
-    return NULL;
-}
 
-static T_expList matchBinopCjumpGe(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_ge) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
+    int i = 0;
+    for (Temp_tempList argregs = F_Argregs(); values && argregs; argregs = argregs->tail) {
+        F_emit(AS_Oper(AS_ADD, L(argregs->head, NULL), L(values->head, L(F_ZERO(), NULL)), NULL));
+        live = L(argregs->head, live);
+        values = values->tail;
+        i++;
     }
-    return NULL;
-}
-
-static T_expList matchBinopCjumpLt0(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_lt && stm->u.CJUMP.right->kind == T_CONST && stm->u.CJUMP.right->u.CONST == 0) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
+    for (; values; values = values->tail, i++) {
+        F_emit(AS_OperImm(AS_SW, NULL, L(values->head, L(F_FP(), NULL)), (i - F_maxRegArg) * F_wordSize));
     }
-    return NULL;
+    return live;
 }
 
-static T_expList matchBinopCjumpGt0(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_gt && stm->u.CJUMP.right->kind == T_CONST && stm->u.CJUMP.right->u.CONST == 0) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
-    }
-    return NULL;
+static AS_targets condTargets(T_stm stm) {
+    return AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)));
 }
 
-static T_expList matchBinopCjumpLe0(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_le && stm->u.CJUMP.right->kind == T_CONST && stm->u.CJUMP.right->u.CONST == 0) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
-    }
-    return NULL;
+static Temp_temp genBinary(AS_opcode op, T_exp left, T_exp right) {
+    Temp_temp r = Temp_newtemp();
+    Temp_temp a = F_doExp(left);
+    F_emit(AS_Oper(op, L(r, NULL), L(a, L(F_doExp(right), NULL)), NULL));
+    return r;
 }
 
-static T_expList matchBinopCjumpGe0(T_stm stm, bool* matched) {
-    if (stm->kind == T_CJUMP && stm->u.CJUMP.op == T_ge && stm->u.CJUMP.right->kind == T_CONST && stm->u.CJUMP.right->u.CONST == 0) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.CJUMP.left, T_ExpList(stm->u.CJUMP.right, NULL));
-    }
-    return NULL;
+static Temp_temp genImm(AS_opcode op, T_exp exp, int imm) {
+    Temp_temp r = Temp_newtemp();
+    F_emit(AS_OperImm(op, L(r, NULL), L(F_doExp(exp), NULL), imm));
+    return r;
 }
 
-static T_expList matchJump(T_stm stm, bool* matched) {
-    if (stm->kind == T_JUMP) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.JUMP.exp, NULL);
-    }
-    return NULL;
+// mult and div leave their result in lo
+static Temp_temp genLo(AS_opcode op, T_exp left, T_exp right) {
+    Temp_temp r = Temp_newtemp();
+    Temp_temp a = F_doExp(left);
+    F_emit(AS_Oper(op, NULL, L(a, L(F_doExp(right), NULL)), NULL));
+    F_emit(AS_Oper(AS_MFLO, L(r, NULL), NULL, NULL));
+    return r;
 }
 
-static T_expList matchNamedJump(T_stm stm, bool* matched) {
-    if (stm->kind == T_JUMP && stm->u.JUMP.exp->kind == T_NAME) {
-        *matched = TRUE;
-        return NULL;
-    }
-    return NULL;
+static void genBranch(AS_opcode op, T_stm stm) {
+    Temp_temp a = F_doExp(stm->u.CJUMP.left);
+    F_emit(AS_OperLabel(op, NULL, L(a, L(F_doExp(stm->u.CJUMP.right), NULL)), stm->u.CJUMP.true,
+                        condTargets(stm)));
 }
 
-static T_expList matchMemLoadOffsetEC(T_exp exp, bool* matched) {
-    if (exp->kind == T_MEM && exp->u.MEM->kind == T_BINOP && exp->u.MEM->u.BINOP.right->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.MEM->u.BINOP.left, NULL);
-    }
-    return NULL;
+// Compare with slt or sltu into $at, then branch on $at against zero
+static void genSltBranch(AS_opcode slt, AS_opcode op, T_exp left, T_exp right, T_stm stm) {
+    Temp_temp a = F_doExp(left);
+    F_emit(AS_Oper(slt, L(F_AT(), NULL), L(a, L(F_doExp(right), NULL)), NULL));
+    F_emit(AS_OperLabel(op, NULL, L(F_AT(), L(F_ZERO(), NULL)), stm->u.CJUMP.true, condTargets(stm)));
 }
 
-static T_expList matchMemLoadOffsetCE(T_exp exp, bool* matched) {
-    if (exp->kind == T_MEM && exp->u.MEM->kind == T_BINOP && exp->u.MEM->u.BINOP.left->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.MEM->u.BINOP.right, NULL);
-    }
-    return NULL;
+static void genSltiBranch(AS_opcode slti, AS_opcode op, int imm, T_stm stm) {
+    F_emit(AS_OperImm(slti, L(F_AT(), NULL), L(F_doExp(stm->u.CJUMP.left), NULL), imm));
+    F_emit(AS_OperLabel(op, NULL, L(F_AT(), L(F_ZERO(), NULL)), stm->u.CJUMP.true, condTargets(stm)));
 }
 
-static T_expList matchMemLoadExp(T_exp exp, bool* matched) {
-    if (exp->kind == T_MEM) {
-        *matched = TRUE;
-        return T_ExpList(exp->u.MEM, NULL);
-    }
-    return NULL;
+// Branch on the sign of one operand, the other being zero
+static void genZeroBranch(AS_opcode op, T_exp exp, T_stm stm) {
+    F_emit(AS_OperLabel(op, NULL, L(F_doExp(exp), NULL), stm->u.CJUMP.true, condTargets(stm)));
 }
 
-static T_expList matchMoveTemp(T_stm stm, bool* matched) {
-    if (stm->kind == T_MOVE && stm->u.MOVE.dst->kind == T_TEMP) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.MOVE.src, NULL);
-    }
-    return NULL;
+// Compare one operand with $zero
+static void genZeroCompare(AS_opcode op, T_exp exp, T_stm stm) {
+    F_emit(AS_OperLabel(op, NULL, L(F_doExp(exp), L(F_ZERO(), NULL)), stm->u.CJUMP.true, condTargets(stm)));
 }
 
-static T_expList matchLabel(T_stm stm, bool* matched) {
-    if (stm->kind == T_LABEL) {
-        *matched = TRUE;
-        return NULL;
-    }
-    return NULL;
+static void genStore(T_exp base, int off, T_exp src) {
+    Temp_temp b = F_doExp(base);
+    F_emit(AS_OperImm(AS_SW, NULL, L(F_doExp(src), L(b, NULL)), off));
 }
 
-static T_expList matchMemStoreOffsetEC(T_stm stm, bool* matched) {
-    if (stm->kind == T_MOVE && stm->u.MOVE.dst->kind == T_MEM
-        && stm->u.MOVE.dst->u.MEM->kind == T_BINOP && stm->u.MOVE.dst->u.MEM->u.BINOP.right->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.MOVE.dst->u.MEM->u.BINOP.left, T_ExpList(stm->u.MOVE.src, NULL));
-    }
-    return NULL;
+static Temp_temp genShift(AS_opcode op, Temp_temp t, int sa) {
+    Temp_temp r = Temp_newtemp();
+    F_emit(AS_OperImm(op, L(r, NULL), L(t, NULL), sa));
+    return r;
 }
 
-static T_expList matchMemStoreOffsetCE(T_stm stm, bool* matched) {
-    if (stm->kind == T_MOVE && stm->u.MOVE.dst->kind == T_MEM
-        && stm->u.MOVE.dst->u.MEM->kind == T_BINOP && stm->u.MOVE.dst->u.MEM->u.BINOP.left->kind == T_CONST) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.MOVE.dst->u.MEM->u.BINOP.right, T_ExpList(stm->u.MOVE.src, NULL));
-    }
-    return NULL;
+static Temp_temp genAdd(Temp_temp a, Temp_temp b) {
+    Temp_temp r = Temp_newtemp();
+    F_emit(AS_Oper(AS_ADD, L(r, NULL), L(a, L(b, NULL)), NULL));
+    return r;
 }
 
-static T_expList matchMemStoreExp(T_stm stm, bool* matched) {
-    if (stm->kind == T_MOVE && stm->u.MOVE.dst->kind == T_MEM) {
-        *matched = TRUE;
-        return T_ExpList(stm->u.MOVE.dst->u.MEM, T_ExpList(stm->u.MOVE.src, NULL));
+// Load a constant that does not fit an immediate field
+static Temp_temp genLoadLarge(int n) {
+    Temp_temp r = Temp_newtemp();
+    F_emit(AS_OperImm(AS_LUI, L(r, NULL), NULL, (unsigned) n >> 16));
+    if (n & 0xffff) {
+        F_emit(AS_OperImm(AS_ORI, L(r, NULL), L(r, NULL), n & 0xffff));
     }
-    return NULL;
-}
-
-static char cbuf[1024];
-
-Temp_tempList L(Temp_temp h, Temp_tempList t) {
-    return Temp_TempList(h, t);
+    return r;
 }
 
-static void genFrameArg(T_expList args, int off) {
-    if (!args) {
-        if (off) {
-            // Reserve stack space
-            sprintf(cbuf, "addiu `d0, `s0, %d\n", -off);
-            string i = String(cbuf);
-            F_emit(AS_Oper(i, L(F_SP(), NULL), L(F_SP(), NULL), NULL));
+/*
+ * Magic number M and shift s for signed division by d > 2, such that
+ * n / d == hi(M * n) >> s, plus one if n is negative (Hacker's Delight, 10-1).
+ */
+static void magic(int d, int *m, int *s) {
+    const unsigned two31 = 0x80000000;
+    unsigned ad = d, anc = two31 - 1 - two31 % ad;
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned q2 = two31 / ad, r2 = two31 - q2 * ad, delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
         }
-        return;
-    }
-
-    genFrameArg(args->tail, off + F_wordSize);
-
-    // Well, args suck
-    sprintf(cbuf, "sw `s0, %d(`s1)\n", off);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(args->head), L(F_SP(), NULL)), NULL));
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *m = (int) (q2 + 1);
+    *s = p - 32;
 }
 
-static void genArg(T_expList args) {
-    for (Temp_tempList argregs = F_Argregs(); args && argregs; argregs = argregs->tail) {
-        F_emit(AS_Oper("add `d0, `s0, `s1\n", L(argregs->head, NULL), L(F_doExp(args->head), L(F_ZERO(), NULL)), NULL));
-        args = args->tail;
-    }
-    if (args) {
-        genFrameArg(args, 0);
-    }
+static Temp_temp genConstZero(T_exp exp) {
+    return F_ZERO();
 }
 
 static Temp_temp genConst(T_exp exp) {
-    sprintf(cbuf, "addi `d0, `s0, %d\n", exp->u.CONST);
     Temp_temp r = Temp_newtemp();
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(r, NULL), L(F_ZERO(), NULL), NULL));
+    F_emit(AS_OperImm(AS_ADDI, L(r, NULL), L(F_ZERO(), NULL), exp->u.CONST));
     return r;
 }
 
+static Temp_temp genConstLarge(T_exp exp) {
+    return genLoadLarge(exp->u.CONST);
+}
+
 static Temp_temp genCall(T_exp exp) {
     genArg(exp->u.CALL.args);
     // TODO: Add Caller-save registers, return value register, and so on (Collect them in calldefs), to param d
-    F_emit(AS_Oper("jalr `s0, `d0\n", L(F_RA(), NULL), L(F_doExp(exp->u.CALL.fun), NULL), NULL));
+    F_emit(AS_Oper(AS_JALR, L(F_RA(), NULL), L(F_doExp(exp->u.CALL.fun), NULL), NULL));
     return F_RV();
 }
 
 static Temp_temp genNamedCall(T_exp exp) {
     genArg(exp->u.CALL.args);
-    sprintf(cbuf, "jal %s\n", exp->u.CALL.fun->u.NAME->name);
-    string i = String(cbuf);
     // TODO: Add Caller-save registers, return value register, and so on (Collect them in calldefs), to param d
-    F_emit(AS_Oper(i, L(F_RA(), NULL), NULL, NULL));
+    F_emit(AS_OperLabel(AS_JAL, L(F_RA(), NULL), NULL, exp->u.CALL.fun->u.NAME, NULL));
+    return F_RV();
+}
+
+static Temp_temp genTailCall(T_exp exp) {
+    // The callee returns straight to our caller, so everything live at a return is live here
+    static Temp_tempList returnSink = NULL;
+    if (!returnSink) {
+        returnSink = L(F_RA(), L(F_FP(), L(F_SP(), F_Calleesaves())));
+    }
+    Temp_tempList live = genTailArg(exp->u.CALL.args, returnSink);
+    F_emit(AS_OperLabel(AS_J, NULL, live, exp->u.CALL.fun->u.NAME, AS_Targets(NULL)));
     return F_RV();
 }
 
 static Temp_temp genName(T_exp exp) {
-    sprintf(cbuf, "la `d0, %s\n", exp->u.NAME->name);
-    string i = String(cbuf);
     Temp_temp r = Temp_newtemp();
-    F_emit(AS_Oper(i, L(r, NULL), NULL, NULL));
+    F_emit(AS_OperLabel(AS_LA, L(r, NULL), NULL, exp->u.NAME, NULL));
     return r;
 }
 
@@ -391,221 +280,285 @@ static void genExp(T_stm stm) {
 }
 
 static Temp_temp genBinopPlus(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    F_emit(AS_Oper("add `d0, `s0, `s1\n", L(r, NULL),
-                   L(F_doExp(exp->u.BINOP.left), L(F_doExp(exp->u.BINOP.right), NULL)), NULL));
-    return r;
+    return genBinary(AS_ADD, exp->u.BINOP.left, exp->u.BINOP.right);
 }
 
 static Temp_temp genBinopPlusImmEC(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    sprintf(cbuf, "addi `d0, `s0, %d\n", exp->u.BINOP.right->u.CONST);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(r, NULL), L(F_doExp(exp->u.BINOP.left), NULL), NULL));
-    return r;
+    return genImm(AS_ADDI, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
 }
 
 static Temp_temp genBinopPlusImmCE(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    sprintf(cbuf, "addi `d0, `s0, %d\n", exp->u.BINOP.left->u.CONST);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(r, NULL), L(F_doExp(exp->u.BINOP.right), NULL), NULL));
-    return r;
+    return genImm(AS_ADDI, exp->u.BINOP.right, exp->u.BINOP.left->u.CONST);
 }
 
 static Temp_temp genBinopMinus(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    F_emit(AS_Oper("sub `d0, `s0, `s1\n", L(r, NULL),
-                   L(F_doExp(exp->u.BINOP.left), L(F_doExp(exp->u.BINOP.right), NULL)), NULL));
-    return r;
+    return genBinary(AS_SUB, exp->u.BINOP.left, exp->u.BINOP.right);
 }
 
 static Temp_temp genBinopMinusImm(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    sprintf(cbuf, "subi `d0, `s0, %d\n", exp->u.BINOP.right->u.CONST);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(r, NULL), L(F_doExp(exp->u.BINOP.left), NULL), NULL));
-    return r;
+    return genImm(AS_ADDI, exp->u.BINOP.left, -exp->u.BINOP.right->u.CONST);
 }
 
 static Temp_temp genBinopDiv(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    F_emit(AS_Oper("div `s0, `s1\nmflo `d0\n", L(r, NULL),
-                   L(F_doExp(exp->u.BINOP.left), L(F_doExp(exp->u.BINOP.right), NULL)), NULL));
-    return r;
+    return genLo(AS_DIV, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+// Division rounds towards zero, so a negative dividend is biased by 2^k - 1 first
+static Temp_temp genBinopDivPow2(T_exp exp) {
+    int k = exactLog2(exp->u.BINOP.right->u.CONST);
+    Temp_temp n = F_doExp(exp->u.BINOP.left);
+    Temp_temp sign = k > 1 ? genShift(AS_SRA, n, k - 1) : n;
+    Temp_temp bias = genShift(AS_SRL, sign, 32 - k);
+    return genShift(AS_SRA, genAdd(n, bias), k);
+}
+
+static Temp_temp genBinopDivMagic(T_exp exp) {
+    int m, s;
+    magic(exp->u.BINOP.right->u.CONST, &m, &s);
+    Temp_temp n = F_doExp(exp->u.BINOP.left);
+    Temp_temp q = Temp_newtemp();
+    F_emit(AS_Oper(AS_MULT, NULL, L(n, L(genLoadLarge(m), NULL)), NULL));
+    F_emit(AS_Oper(AS_MFHI, L(q, NULL), NULL, NULL));
+    if (m < 0) {
+        q = genAdd(q, n);
+    }
+    if (s > 0) {
+        q = genShift(AS_SRA, q, s);
+    }
+    return genAdd(q, genShift(AS_SRL, n, 31));
 }
 
 static Temp_temp genBinopMul(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    F_emit(AS_Oper("mult `s0, `s1\nmflo `d0\n", L(r, NULL),
-                   L(F_doExp(exp->u.BINOP.left), L(F_doExp(exp->u.BINOP.right), NULL)), NULL));
-    return r;
+    return genLo(AS_MULT, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopMulPow2EC(T_exp exp) {
+    return genImm(AS_SLL, exp->u.BINOP.left, exactLog2(exp->u.BINOP.right->u.CONST));
+}
+
+static Temp_temp genBinopMulPow2CE(T_exp exp) {
+    return genImm(AS_SLL, exp->u.BINOP.right, exactLog2(exp->u.BINOP.left->u.CONST));
+}
+
+static Temp_temp genBinopAnd(T_exp exp) {
+    return genBinary(AS_AND, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopAndImm(T_exp exp) {
+    return genImm(AS_ANDI, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+static Temp_temp genBinopOr(T_exp exp) {
+    return genBinary(AS_OR, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopOrImm(T_exp exp) {
+    return genImm(AS_ORI, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+static Temp_temp genBinopXor(T_exp exp) {
+    return genBinary(AS_XOR, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopXorImm(T_exp exp) {
+    return genImm(AS_XORI, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+// The variable shifts take the shift amount as rs, so it is s1 here
+static Temp_temp genBinopLshift(T_exp exp) {
+    return genBinary(AS_SLLV, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopLshiftImm(T_exp exp) {
+    return genImm(AS_SLL, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+static Temp_temp genBinopRshift(T_exp exp) {
+    return genBinary(AS_SRLV, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopRshiftImm(T_exp exp) {
+    return genImm(AS_SRL, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+static Temp_temp genBinopArshift(T_exp exp) {
+    return genBinary(AS_SRAV, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopArshiftImm(T_exp exp) {
+    return genImm(AS_SRA, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+static Temp_temp genBinopSlt(T_exp exp) {
+    return genBinary(AS_SLT, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopSltImm(T_exp exp) {
+    return genImm(AS_SLTI, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
+}
+
+static Temp_temp genBinopSltu(T_exp exp) {
+    return genBinary(AS_SLTU, exp->u.BINOP.left, exp->u.BINOP.right);
+}
+
+static Temp_temp genBinopSltuImm(T_exp exp) {
+    return genImm(AS_SLTIU, exp->u.BINOP.left, exp->u.BINOP.right->u.CONST);
 }
 
 static void genBinopCjumpEq(T_stm stm) {
-    sprintf(cbuf, "beq `s0, `s1, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.CJUMP.left), L(F_doExp(stm->u.CJUMP.right), NULL)),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genBranch(AS_BEQ, stm);
 }
 
 static void genBinopCjumpNe(T_stm stm) {
-    sprintf(cbuf, "bne `s0, `s1, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.CJUMP.left), L(F_doExp(stm->u.CJUMP.right), NULL)),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genBranch(AS_BNE, stm);
 }
 
 static void genBinopCjumpLt(T_stm stm) {
-    sprintf(cbuf, "slt `d0, `s0, `s1\nbne `d0, `s2, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(F_AT(), NULL), L(F_doExp(stm->u.CJUMP.left), L(F_doExp(stm->u.CJUMP.right), L(F_ZERO(), NULL))),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genSltBranch(AS_SLT, AS_BNE, stm->u.CJUMP.left, stm->u.CJUMP.right, stm);
 }
 
 static void genBinopCjumpGe(T_stm stm) {
-    sprintf(cbuf, "slt `d0, `s0, `s1\nbeq `d0, `s2, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(F_AT(), NULL), L(F_doExp(stm->u.CJUMP.left), L(F_doExp(stm->u.CJUMP.right), L(F_ZERO(), NULL))),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genSltBranch(AS_SLT, AS_BEQ, stm->u.CJUMP.left, stm->u.CJUMP.right, stm);
 }
 
 static void genBinopCjumpGt(T_stm stm) {
-    sprintf(cbuf, "slt `d0, `s1, `s0\nbne `d0, `s2, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(F_AT(), NULL), L(F_doExp(stm->u.CJUMP.left), L(F_doExp(stm->u.CJUMP.right), L(F_ZERO(), NULL))),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genSltBranch(AS_SLT, AS_BNE, stm->u.CJUMP.right, stm->u.CJUMP.left, stm);
 }
 
 static void genBinopCjumpLe(T_stm stm) {
-    sprintf(cbuf, "slt `d0, `s1, `s0\nbeq `d0, `s2, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(F_AT(), NULL), L(F_doExp(stm->u.CJUMP.left), L(F_doExp(stm->u.CJUMP.right), L(F_ZERO(), NULL))),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genSltBranch(AS_SLT, AS_BEQ, stm->u.CJUMP.right, stm->u.CJUMP.left, stm);
+}
+
+static void genBinopCjumpUlt(T_stm stm) {
+    genSltBranch(AS_SLTU, AS_BNE, stm->u.CJUMP.left, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjumpUge(T_stm stm) {
+    genSltBranch(AS_SLTU, AS_BEQ, stm->u.CJUMP.left, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjumpUgt(T_stm stm) {
+    genSltBranch(AS_SLTU, AS_BNE, stm->u.CJUMP.right, stm->u.CJUMP.left, stm);
+}
+
+static void genBinopCjumpUle(T_stm stm) {
+    genSltBranch(AS_SLTU, AS_BEQ, stm->u.CJUMP.right, stm->u.CJUMP.left, stm);
+}
+
+static void genBinopCjumpLtImm(T_stm stm) {
+    genSltiBranch(AS_SLTI, AS_BNE, stm->u.CJUMP.right->u.CONST, stm);
+}
+
+static void genBinopCjumpGeImm(T_stm stm) {
+    genSltiBranch(AS_SLTI, AS_BEQ, stm->u.CJUMP.right->u.CONST, stm);
+}
+
+static void genBinopCjumpGtImm(T_stm stm) {
+    genSltiBranch(AS_SLTI, AS_BEQ, stm->u.CJUMP.right->u.CONST + 1, stm);
+}
+
+static void genBinopCjumpLeImm(T_stm stm) {
+    genSltiBranch(AS_SLTI, AS_BNE, stm->u.CJUMP.right->u.CONST + 1, stm);
+}
+
+static void genBinopCjumpUltImm(T_stm stm) {
+    genSltiBranch(AS_SLTIU, AS_BNE, stm->u.CJUMP.right->u.CONST, stm);
+}
+
+static void genBinopCjumpUgeImm(T_stm stm) {
+    genSltiBranch(AS_SLTIU, AS_BEQ, stm->u.CJUMP.right->u.CONST, stm);
+}
+
+static void genBinopCjumpEq0(T_stm stm) {
+    genZeroCompare(AS_BEQ, stm->u.CJUMP.left, stm);
+}
+
+static void genBinopCjumpNe0(T_stm stm) {
+    genZeroCompare(AS_BNE, stm->u.CJUMP.left, stm);
 }
 
 static void genBinopCjumpLt0(T_stm stm) {
-    sprintf(cbuf, "bltz `s0, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.CJUMP.left), NULL),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genZeroBranch(AS_BLTZ, stm->u.CJUMP.left, stm);
 }
 
-static void genBinopCjumpLe0(T_stm stm) {
-    sprintf(cbuf, "blez `s0, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.CJUMP.left), NULL),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+static void genBinopCjumpGe0(T_stm stm) {
+    genZeroBranch(AS_BGEZ, stm->u.CJUMP.left, stm);
 }
 
 static void genBinopCjumpGt0(T_stm stm) {
-    sprintf(cbuf, "bgtz `s0, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.CJUMP.left), NULL),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+    genZeroBranch(AS_BGTZ, stm->u.CJUMP.left, stm);
 }
 
-static void genBinopCjumpGe0(T_stm stm) {
-    sprintf(cbuf, "bgez `s0, %s\n", stm->u.CJUMP.true->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.CJUMP.left), NULL),
-                   AS_Targets(Temp_LabelList(stm->u.CJUMP.false, Temp_LabelList(stm->u.CJUMP.true, NULL)))));
+static void genBinopCjumpLe0(T_stm stm) {
+    genZeroBranch(AS_BLEZ, stm->u.CJUMP.left, stm);
+}
+
+static void genBinopCjump0Eq(T_stm stm) {
+    genZeroCompare(AS_BEQ, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjump0Ne(T_stm stm) {
+    genZeroCompare(AS_BNE, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjump0Lt(T_stm stm) {
+    genZeroBranch(AS_BGTZ, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjump0Ge(T_stm stm) {
+    genZeroBranch(AS_BLEZ, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjump0Gt(T_stm stm) {
+    genZeroBranch(AS_BLTZ, stm->u.CJUMP.right, stm);
+}
+
+static void genBinopCjump0Le(T_stm stm) {
+    genZeroBranch(AS_BGEZ, stm->u.CJUMP.right, stm);
 }
 
 static void genJump(T_stm stm) {
     // TODO: In this situation, what targets will be?
-    F_emit(AS_Oper("jr `s0\n", NULL, L(F_doExp(stm->u.JUMP.exp), NULL), AS_Targets(stm->u.JUMP.jumps)));
+    F_emit(AS_Oper(AS_JR, NULL, L(F_doExp(stm->u.JUMP.exp), NULL), AS_Targets(stm->u.JUMP.jumps)));
 }
 
 static void genNamedJump(T_stm stm) {
-    sprintf(cbuf, "j %s\n", stm->u.JUMP.exp->u.NAME->name);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, NULL, AS_Targets(stm->u.JUMP.jumps)));
+    F_emit(AS_OperLabel(AS_J, NULL, NULL, stm->u.JUMP.exp->u.NAME, AS_Targets(stm->u.JUMP.jumps)));
 }
 
 static Temp_temp genMemLoadOffsetEC(T_exp exp) {
-    sprintf(cbuf, "lw `d0, %d(`s0)\n", exp->u.MEM->u.BINOP.right->u.CONST);
-    Temp_temp r = Temp_newtemp();
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(r, NULL), L(F_doExp(exp->u.MEM->u.BINOP.left), NULL), NULL));
-    return r;
+    return genImm(AS_LW, exp->u.MEM->u.BINOP.left, exp->u.MEM->u.BINOP.right->u.CONST);
 }
 
 static Temp_temp genMemLoadOffsetCE(T_exp exp) {
-    sprintf(cbuf, "lw `d0, %d(`s0)\n", exp->u.MEM->u.BINOP.left->u.CONST);
-    Temp_temp r = Temp_newtemp();
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, L(r, NULL), L(F_doExp(exp->u.MEM->u.BINOP.right), NULL), NULL));
-    return r;
+    return genImm(AS_LW, exp->u.MEM->u.BINOP.right, exp->u.MEM->u.BINOP.left->u.CONST);
 }
 
 static Temp_temp genMemLoadExp(T_exp exp) {
-    Temp_temp r = Temp_newtemp();
-    F_emit(AS_Oper("lw `d0, 0(`s0)\n", L(r, NULL), L(F_doExp(exp->u.MEM), NULL), NULL));
-    return r;
+    return genImm(AS_LW, exp->u.MEM, 0);
 }
 
 static void genMoveTemp(T_stm stm) {
-    F_emit(AS_Move("add `d0, `s0, `s1\n", L(stm->u.MOVE.dst->u.TEMP, NULL),
+    F_emit(AS_Move(AS_ADD, L(stm->u.MOVE.dst->u.TEMP, NULL),
                    L(F_doExp(stm->u.MOVE.src), L(F_ZERO(), NULL))));
 }
 
 static void genLabel(T_stm stm) {
-    sprintf(cbuf, "%s:\n", stm->u.LABEL->name);
-    string i = String(cbuf);
-    F_emit(AS_Label(i, stm->u.LABEL));
+    F_emit(AS_Label(stm->u.LABEL));
 }
 
 static void genMemStoreOffsetEC(T_stm stm) {
-    sprintf(cbuf, "sw `s1, %d(`s0)\n", stm->u.MOVE.dst->u.MEM->u.BINOP.right->u.CONST);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.MOVE.dst->u.MEM->u.BINOP.left), L(F_doExp(stm->u.MOVE.src), NULL)), NULL));
+    T_exp addr = stm->u.MOVE.dst->u.MEM;
+    genStore(addr->u.BINOP.left, addr->u.BINOP.right->u.CONST, stm->u.MOVE.src);
 }
 
 static void genMemStoreOffsetCE(T_stm stm) {
-    sprintf(cbuf, "sw `s1, %d(`s0)\n", stm->u.MOVE.dst->u.MEM->u.BINOP.left->u.CONST);
-    string i = String(cbuf);
-    F_emit(AS_Oper(i, NULL, L(F_doExp(stm->u.MOVE.dst->u.MEM->u.BINOP.right), L(F_doExp(stm->u.MOVE.src), NULL)), NULL));
+    T_exp addr = stm->u.MOVE.dst->u.MEM;
+    genStore(addr->u.BINOP.right, addr->u.BINOP.left->u.CONST, stm->u.MOVE.src);
 }
 
 static void genMemStoreExp(T_stm stm) {
-    F_emit(AS_Oper("sw `s1, 0(`s0)\n", NULL, L(F_doExp(stm->u.MOVE.dst->u.MEM), L(F_doExp(stm->u.MOVE.src), NULL)), NULL));
-}
-
-F_pattern F_patterns[] = {
-        {PAT_EXP, {.exp = matchConst}, {.exp = genConst}, 1},
-        {PAT_EXP, {.exp = matchCall}, {.exp = genCall}, 1},
-        {PAT_EXP, {.exp = matchNamedCall}, {.exp = genNamedCall}, 1},
-        {PAT_EXP, {.exp = matchName}, {.exp = genName}, 1},
-        {PAT_EXP, {.exp = matchTemp}, {.exp = genTemp}, 0},
-        {PAT_STM, {.stm = matchExp}, {.stm = genExp}, 0},
-        {PAT_EXP, {.exp = matchBinopPlus}, {.exp = genBinopPlus}, 1},
-        {PAT_EXP, {.exp = matchBinopPlusImmEC}, {.exp = genBinopPlusImmEC}, 1},
-        {PAT_EXP, {.exp = matchBinopPlusImmCE}, {.exp = genBinopPlusImmCE}, 1},
-        {PAT_EXP, {.exp = matchBinopMinus}, {.exp = genBinopMinus}, 1},
-        {PAT_EXP, {.exp = matchBinopMinusImm}, {.exp = genBinopMinusImm}, 1},
-        {PAT_EXP, {.exp = matchBinopDiv}, {.exp = genBinopDiv}, 1},
-        {PAT_EXP, {.exp = matchBinopMul}, {.exp = genBinopMul}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpEq}, {.stm = genBinopCjumpEq}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpNe}, {.stm = genBinopCjumpNe}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpLt}, {.stm = genBinopCjumpLt}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpGe}, {.stm = genBinopCjumpGe}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpGt}, {.stm = genBinopCjumpGt}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpLe}, {.stm = genBinopCjumpLe}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpLt0}, {.stm = genBinopCjumpLt0}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpGe0}, {.stm = genBinopCjumpGe0}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpGt0}, {.stm = genBinopCjumpGt0}, 1},
-        {PAT_STM, {.stm = matchBinopCjumpLe0}, {.stm = genBinopCjumpLe0}, 1},
-        {PAT_STM, {.stm = matchJump}, {.stm = genJump}, 1},
-        {PAT_STM, {.stm = matchNamedJump}, {.stm = genNamedJump}, 1},
-        {PAT_EXP, {.exp = matchMemLoadOffsetEC}, {.exp = genMemLoadOffsetEC}, 1},
-        {PAT_EXP, {.exp = matchMemLoadOffsetCE}, {.exp = genMemLoadOffsetCE}, 1},
-        {PAT_EXP, {.exp = matchMemLoadExp}, {.exp = genMemLoadExp}, 1},
-        {PAT_STM, {.stm = matchMoveTemp}, {.stm = genMoveTemp}, 1},
-        {PAT_STM, {.stm = matchLabel}, {.stm = genLabel}, 1},
-        {PAT_STM, {.stm = matchMemStoreOffsetEC}, {.stm = genMemStoreOffsetEC}, 1},
-        {PAT_STM, {.stm = matchMemStoreOffsetCE}, {.stm = genMemStoreOffsetCE}, 1},
-        {PAT_STM, {.stm = matchMemStoreExp}, {.stm = genMemStoreExp}, 1},
-};
-
-int F_nPattern = sizeof(F_patterns) / sizeof(F_pattern);
+    genStore(stm->u.MOVE.dst->u.MEM, 0, stm->u.MOVE.src);
+}
+
+#include "mipsburg.h"
@@ -42,6 +42,16 @@ static struct Temp_temp_ f_t0 = {18}, f_t1 = {19}, f_t2 = {20}, f_t3 = {21},
 const int F_wordSize = 4;
 const int F_maxRegArg = 4;
 
+// Switch to F_display, or build with TIGER_DISPLAY, to reach outer variables with one load instead of a static link chain
+#ifdef TIGER_DISPLAY
+const F_linkMode F_link = F_display;
+#else
+const F_linkMode F_link = F_staticLinks;
+#endif
+
+// Must match the size of the display array in the runtime
+#define DISPLAY_SIZE 64
+
 F_accessList F_AccessList(F_access head, F_accessList tail) {
     F_accessList p = checked_malloc(sizeof(*p));
     p->head = head;
@@ -58,31 +68,51 @@ struct F_access_ {
         int offset;         // inFrame
         Temp_temp reg;      // inReg
     };
+    bool pointer;
 };
 
-static F_access InFrame(int offset) {
+static F_access InFrame(int offset, bool pointer) {
     F_access access = checked_malloc(sizeof(*access));
     access->kind = inFrame;
     access->offset = offset;
+    access->pointer = pointer;
     return access;
 }
 
-static F_access InReg(Temp_temp reg) {
+static F_access InReg(Temp_temp reg, bool pointer) {
     F_access access = checked_malloc(sizeof(*access));
     access->kind = inReg;
     access->reg = reg;
+    access->pointer = pointer;
+    reg->pointer = pointer;
+    return access;
+}
+
+// Pointer variables in the frame are listed for the stack maps; those in temps mark them
+static F_access newAccess(F_frame frame, bool escape, int offset, bool pointer) {
+    if (!escape) {
+        return InReg(Temp_newtemp(), pointer);
+    }
+    F_access access = InFrame(offset, pointer);
+    if (pointer) {
+        frame->pointers = F_AccessList(access, frame->pointers);
+    }
     return access;
 }
 
-F_frame F_newFrame(Temp_label name, U_boolList formals) {
+F_frame F_newFrame(Temp_label name, U_boolList formals, U_boolList pointers) {
     F_frame frame = checked_malloc(sizeof(*frame));
     frame->name = name;
+    frame->n_frame_local = 0;
     frame->formals = NULL;
+    frame->pointers = NULL;
     F_accessList tail = NULL;
     int offset = -F_wordSize;
     for (U_boolList p = formals; p; p = p->tail) {
-        F_accessList entry = F_AccessList(p->head ? InFrame(offset += F_wordSize)
-                                                        : InReg(Temp_newtemp()), NULL);
+        bool pointer = pointers && pointers->head;
+        F_accessList entry = F_AccessList(newAccess(frame, p->head, p->head ? offset += F_wordSize : 0, pointer),
+                                          NULL);
+        pointers = pointers ? pointers->tail : NULL;
         if (!frame->formals) {
             frame->formals = tail = entry;
         } else {
@@ -93,12 +123,68 @@ F_frame F_newFrame(Temp_label name, U_boolList formals) {
     return frame;
 }
 
-F_access F_allocLocal(F_frame f, bool escape) {
-    if (escape) {
-        return InFrame(-(1 + f->n_frame_local++) * F_wordSize);
+F_access F_allocLocal(F_frame f, bool escape, bool pointer) {
+    return newAccess(f, escape, escape ? -(1 + f->n_frame_local++) * F_wordSize : 0, pointer);
+}
+
+bool F_isPointer(F_access access) {
+    return access->pointer;
+}
+
+int F_offset(F_access access) {
+    assert(access->kind == inFrame);
+    return access->offset;
+}
+
+T_stm F_clearPointers(F_frame frame) {
+    T_stm clear = NULL;
+    for (F_accessList p = frame->pointers; p; p = p->tail) {
+        // Formals lie above the frame pointer and arrive initialized
+        if (p->head->offset < 0) {
+            T_stm move = T_Move(F_exp(p->head, T_Temp(F_FP())), T_Const(0));
+            clear = clear ? T_Seq(move, clear) : move;
+        }
     }
+    return clear;
+}
 
-    return InReg(Temp_newtemp());
+/*
+ * A sibling tail call releases the caller's frame before jumping to the callee,
+ * so the arguments the callee expects on the stack must fit into the incoming
+ * argument area of the caller.
+ */
+static int nStackFormal(F_frame frame) {
+    int n = 0;
+    for (F_accessList p = frame->formals; p; p = p->tail) {
+        n++;
+    }
+    return n > F_maxRegArg ? n - F_maxRegArg : 0;
+}
+
+bool F_frameFits(F_frame caller, F_frame callee) {
+    return nStackFormal(callee) <= nStackFormal(caller);
+}
+
+/*
+ * With a display, a function whose frame holds escaping variables saves the display
+ * slot of its depth, stores its frame pointer there, and restores the slot on exit.
+ * Outer variables are then one load away, however deep the nesting.
+ */
+T_exp F_displayEntry(int depth) {
+    assert(depth >= 0 && depth < DISPLAY_SIZE);
+    return T_Mem(T_Binop(T_plus, T_Name(Temp_namedlabel("display")), T_Const(depth * F_wordSize)));
+}
+
+bool F_hasEscaping(F_frame frame) {
+    if (frame->n_frame_local) {
+        return TRUE;
+    }
+    for (F_accessList p = frame->formals; p; p = p->tail) {
+        if (p->head->kind == inFrame) {
+            return TRUE;
+        }
+    }
+    return FALSE;
 }
 
 Temp_label F_name(F_frame frame) {
@@ -180,7 +266,7 @@ AS_instrList F_procEntryExit2(AS_instrList body) {
         for (; tail->tail; tail = tail->tail);
         tail->tail = F_Calleesaves();
     }
-    return AS_splice(body, AS_InstrList(AS_Oper("", NULL, returnSink, NULL), NULL));
+    return AS_splice(body, AS_InstrList(AS_Oper(AS_SINK, NULL, returnSink, NULL), NULL));
 }
 
 Temp_map F_TempMap() {
@@ -21,30 +21,48 @@ AS_targets AS_Targets(Temp_labelList labels) {
    return p;
 }
 
-AS_instr AS_Oper(string a, Temp_tempList d, Temp_tempList s, AS_targets j) {
+AS_instr AS_Oper(AS_opcode op, Temp_tempList d, Temp_tempList s, AS_targets j) {
   AS_instr p = (AS_instr) checked_malloc (sizeof *p);
   p->kind = I_OPER;
-  p->u.OPER.assem=a; 
+  p->op = op;
   p->u.OPER.dst=d; 
   p->u.OPER.src=s; 
   p->u.OPER.jumps=j;
+  p->imm = 0;
+  p->label = NULL;
   return p;
 }
 
-AS_instr AS_Label(string a, Temp_label label) {
+AS_instr AS_OperImm(AS_opcode op, Temp_tempList d, Temp_tempList s, int imm) {
+  AS_instr p = AS_Oper(op, d, s, NULL);
+  p->imm = imm;
+  return p;
+}
+
+AS_instr AS_OperLabel(AS_opcode op, Temp_tempList d, Temp_tempList s, Temp_label label, AS_targets j) {
+  AS_instr p = AS_Oper(op, d, s, j);
+  p->label = label;
+  return p;
+}
+
+AS_instr AS_Label(Temp_label label) {
   AS_instr p = (AS_instr) checked_malloc (sizeof *p);
   p->kind = I_LABEL;
-  p->u.LABEL.assem=a; 
   p->u.LABEL.label=label; 
+  p->op = AS_SINK;
+  p->imm = 0;
+  p->label = label;
   return p;
 }
 
-AS_instr AS_Move(string a, Temp_tempList d, Temp_tempList s) {
+AS_instr AS_Move(AS_opcode op, Temp_tempList d, Temp_tempList s) {
   AS_instr p = (AS_instr) checked_malloc (sizeof *p);
   p->kind = I_MOVE;
-  p->u.MOVE.assem=a; 
+  p->op = op;
   p->u.MOVE.dst=d; 
   p->u.MOVE.src=s; 
+  p->imm = 0;
+  p->label = NULL;
   return p;
 }
 
@@ -69,72 +87,137 @@ static Temp_temp nthTemp(Temp_tempList list, int i) {
   else return nthTemp(list->tail,i-1);
 }
 
-static Temp_label nthLabel(Temp_labelList list, int i) {
-  assert(list);
-  if (i==0) return list->head;
-  else return nthLabel(list->tail,i-1);
-}
+/* Operand formats: d = destination, s = source, i = immediate, l = label */
+typedef enum {
+  FMT_NONE, FMT_DSS, FMT_DSI, FMT_SS, FMT_D, FMT_S, FMT_DI, FMT_LOAD, FMT_STORE,
+  FMT_DL, FMT_SSL, FMT_SL, FMT_L
+} AS_format;
 
+static struct {string name; AS_format format;} opInfo[] = {
+  [AS_ADD] = {"add", FMT_DSS},     [AS_ADDI] = {"addi", FMT_DSI},
+  [AS_ADDIU] = {"addiu", FMT_DSI}, [AS_SUB] = {"sub", FMT_DSS},
+  [AS_MULT] = {"mult", FMT_SS},    [AS_DIV] = {"div", FMT_SS},
+  [AS_MFHI] = {"mfhi", FMT_D},     [AS_MFLO] = {"mflo", FMT_D},
+  [AS_AND] = {"and", FMT_DSS},     [AS_ANDI] = {"andi", FMT_DSI},
+  [AS_OR] = {"or", FMT_DSS},       [AS_ORI] = {"ori", FMT_DSI},
+  [AS_XOR] = {"xor", FMT_DSS},     [AS_XORI] = {"xori", FMT_DSI},
+  [AS_SLL] = {"sll", FMT_DSI},     [AS_SRL] = {"srl", FMT_DSI},
+  [AS_SRA] = {"sra", FMT_DSI},     [AS_SLLV] = {"sllv", FMT_DSS},
+  [AS_SRLV] = {"srlv", FMT_DSS},   [AS_SRAV] = {"srav", FMT_DSS},
+  [AS_SLT] = {"slt", FMT_DSS},     [AS_SLTI] = {"slti", FMT_DSI},
+  [AS_SLTU] = {"sltu", FMT_DSS},   [AS_SLTIU] = {"sltiu", FMT_DSI},
+  [AS_LUI] = {"lui", FMT_DI},      [AS_LW] = {"lw", FMT_LOAD},
+  [AS_SW] = {"sw", FMT_STORE},     [AS_LA] = {"la", FMT_DL},
+  [AS_BEQ] = {"beq", FMT_SSL},     [AS_BNE] = {"bne", FMT_SSL},
+  [AS_BLTZ] = {"bltz", FMT_SL},    [AS_BGEZ] = {"bgez", FMT_SL},
+  [AS_BGTZ] = {"bgtz", FMT_SL},    [AS_BLEZ] = {"blez", FMT_SL},
+  [AS_J] = {"j", FMT_L},           [AS_JR] = {"jr", FMT_S},
+  [AS_JAL] = {"jal", FMT_L},       [AS_JALR] = {"jalr", FMT_S},
+  [AS_NOP] = {"nop", FMT_NONE},    [AS_SINK] = {"", FMT_NONE},
+};
 
-/* first param is string created by this function by reading 'assem' string
- * and replacing `d `s and `j stuff.
- * Last param is function to use to determine what to do with each temp.
- */
-static void format(char *result, string assem, 
-		   Temp_tempList dst, Temp_tempList src,
-		   AS_targets jumps, Temp_map m)
+/* Copy s to p, returning the end of the copy */
+static char *append(char *p, string s)
 {
-  char *p;
-  int i = 0; /* offset to result string */
-  for(p = assem; p && *p != '\0'; p++)
-    if (*p == '`')
-      switch(*(++p)) {
-      case 's': {int n = atoi(++p);
-		 string s = Temp_look(m, nthTemp(src,n));
-		 strcpy(result+i, s);
-		 i += strlen(s);
-	       }
-	break;
-      case 'd': {int n = atoi(++p);
-		 string s = Temp_look(m, nthTemp(dst,n));
-		 strcpy(result+i, s);
-		 i += strlen(s);
-	       }
-	break;
-      case 'j': assert(jumps); 
-	       {int n = atoi(++p);
-		 string s = Temp_labelstring(nthLabel(jumps->labels,n));
-		 strcpy(result+i, s);
-		 i += strlen(s);
-	       }
-	break;
-      case '`': result[i] = '`'; i++; 
-	break;
-      default: assert(0);
-      }
-    else {result[i] = *p; i++; }
-  result[i] = '\0';
+  while (*s) *p++ = *s++;
+  return p;
 }
 
+static char *appendInt(char *p, int n)
+{
+  char digits[12];
+  int k = 0;
+  unsigned u = n < 0 ? -(unsigned) n : (unsigned) n;
+  if (n < 0) *p++ = '-';
+  do { digits[k++] = '0' + u % 10; u /= 10; } while (u);
+  while (k) *p++ = digits[--k];
+  return p;
+}
 
+/* Print the operands of i in the format of its opcode, naming temps by m.
+ * The line is built in a buffer and written at once, as printf formats
+ * cost more than the copying in a large function.
+ * A store takes the stored value as s0 and the base address as s1. */
 void AS_print(FILE *out, AS_instr i, Temp_map m)
 {
-  char r[200]; /* result */
-  switch (i->kind) {
-  case I_OPER:
-    format(r, i->u.OPER.assem, i->u.OPER.dst, i->u.OPER.src, i->u.OPER.jumps, m);
-    fprintf(out, "%s", r);
+  Temp_tempList dst, src;
+  char line[200], *p = line;
+  if (i->kind == I_LABEL) {
+    p = append(append(p, Temp_labelstring(i->u.LABEL.label)), ":\n");
+    *p = '\0';
+    fputs(line, out);
+    return;
+  }
+  if (i->kind == I_OPER) {
+    dst = i->u.OPER.dst; src = i->u.OPER.src;
+  } else {
+    dst = i->u.MOVE.dst; src = i->u.MOVE.src;
+  }
+
+  AS_format format = opInfo[i->op].format;
+  string name = opInfo[i->op].name;
+  if (format == FMT_NONE && !*name) return;
+  p = append(p, name);
+  if (format != FMT_NONE) *p++ = ' ';
+  switch (format) {
+  case FMT_NONE:
+    break;
+  case FMT_DSS:
+    p = append(append(p, Temp_look(m, nthTemp(dst,0))), ", ");
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ", ");
+    p = append(p, Temp_look(m, nthTemp(src,1)));
+    break;
+  case FMT_DSI:
+    p = append(append(p, Temp_look(m, nthTemp(dst,0))), ", ");
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ", ");
+    p = appendInt(p, i->imm);
+    break;
+  case FMT_SS:
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ", ");
+    p = append(p, Temp_look(m, nthTemp(src,1)));
+    break;
+  case FMT_D:
+    p = append(p, Temp_look(m, nthTemp(dst,0)));
+    break;
+  case FMT_S:
+    p = append(p, Temp_look(m, nthTemp(src,0)));
+    break;
+  case FMT_DI:
+    p = append(append(p, Temp_look(m, nthTemp(dst,0))), ", ");
+    p = appendInt(p, i->imm);
+    break;
+  case FMT_LOAD:
+    p = append(append(p, Temp_look(m, nthTemp(dst,0))), ", ");
+    p = append(appendInt(p, i->imm), "(");
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ")");
+    break;
+  case FMT_STORE:
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ", ");
+    p = append(appendInt(p, i->imm), "(");
+    p = append(append(p, Temp_look(m, nthTemp(src,1))), ")");
+    break;
+  case FMT_DL:
+    p = append(append(p, Temp_look(m, nthTemp(dst,0))), ", ");
+    p = append(p, Temp_labelstring(i->label));
+    break;
+  case FMT_SSL:
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ", ");
+    p = append(append(p, Temp_look(m, nthTemp(src,1))), ", ");
+    p = append(p, Temp_labelstring(i->label));
     break;
-  case I_LABEL:
-    format(r, i->u.LABEL.assem, NULL, NULL, NULL, m); 
-    fprintf(out, "%s", r); 
-    /* i->u.LABEL->label); */
+  case FMT_SL:
+    p = append(append(p, Temp_look(m, nthTemp(src,0))), ", ");
+    p = append(p, Temp_labelstring(i->label));
     break;
-  case I_MOVE:
-    format(r, i->u.MOVE.assem, i->u.MOVE.dst, i->u.MOVE.src, NULL, m);
-    fprintf(out, "%s", r);
+  case FMT_L:
+    p = append(p, Temp_labelstring(i->label));
     break;
+  default:
+    assert(0);
   }
+  *p++ = '\n';
+  *p = '\0';
+  fputs(line, out);
 }
 
 /* c should be COL_color; temporarily it is not */
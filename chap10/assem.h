@@ -11,18 +11,38 @@
 typedef struct {Temp_labelList labels;} *AS_targets;
 AS_targets AS_Targets(Temp_labelList labels);
 
+/*
+ * Opcodes of the target machine (MIPS). Each has an operand format,
+ * see AS_print; AS_SINK is a pseudo instruction that prints as nothing.
+ */
+typedef enum {
+    AS_ADD, AS_ADDI, AS_ADDIU, AS_SUB, AS_MULT, AS_DIV, AS_MFHI, AS_MFLO,
+    AS_AND, AS_ANDI, AS_OR, AS_ORI, AS_XOR, AS_XORI,
+    AS_SLL, AS_SRL, AS_SRA, AS_SLLV, AS_SRLV, AS_SRAV,
+    AS_SLT, AS_SLTI, AS_SLTU, AS_SLTIU,
+    AS_LUI, AS_LW, AS_SW, AS_LA,
+    AS_BEQ, AS_BNE, AS_BLTZ, AS_BGEZ, AS_BGTZ, AS_BLEZ,
+    AS_J, AS_JR, AS_JAL, AS_JALR,
+    AS_NOP, AS_SINK
+} AS_opcode;
+
 typedef struct AS_instr_ *AS_instr;
 struct AS_instr_ { enum {I_OPER, I_LABEL, I_MOVE} kind;
-	       union {struct {string assem; Temp_tempList dst, src; 
+	       union {struct {Temp_tempList dst, src;
 			      AS_targets jumps;} OPER;
-		      struct {string assem; Temp_label label;} LABEL;
-		      struct {string assem; Temp_tempList dst, src;} MOVE;
+		      struct {Temp_label label;} LABEL;
+		      struct {Temp_tempList dst, src;} MOVE;
 		    } u;
+	       AS_opcode op;       /* I_OPER and I_MOVE */
+	       int imm;            /* immediate, or offset of a memory operand */
+	       Temp_label label;   /* label operand of a branch, call or la */
 	      };
 
-AS_instr AS_Oper(string a, Temp_tempList d, Temp_tempList s, AS_targets j);
-AS_instr AS_Label(string a, Temp_label label);
-AS_instr AS_Move(string a, Temp_tempList d, Temp_tempList s);
+AS_instr AS_Oper(AS_opcode op, Temp_tempList d, Temp_tempList s, AS_targets j);
+AS_instr AS_OperImm(AS_opcode op, Temp_tempList d, Temp_tempList s, int imm);
+AS_instr AS_OperLabel(AS_opcode op, Temp_tempList d, Temp_tempList s, Temp_label label, AS_targets j);
+AS_instr AS_Label(Temp_label label);
+AS_instr AS_Move(AS_opcode op, Temp_tempList d, Temp_tempList s);
 
 void AS_print(FILE *out, AS_instr i, Temp_map m);
 
@@ -3,11 +3,14 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "util.h"
 #include "symbol.h"
 #include "temp.h"
 #include "tree.h"
 #include "canon.h"
+#include "frame.h"
 
 typedef struct expRefList_ *expRefList;
 struct expRefList_ {T_exp *head; expRefList tail;};
@@ -16,7 +19,29 @@ struct expRefList_ {T_exp *head; expRefList tail;};
 static T_stm do_stm(T_stm stm);
 static struct stmExp do_exp(T_exp exp);
 static C_stmListList mkBlocks(T_stmList stms, Temp_label done);
-static T_stmList getNext(void);
+
+/* Worklist of statements, instead of recursion on long sequences */
+typedef struct {T_stm *items; int n, size;} stmStack;
+
+static stmStack StmStack(void)
+{stmStack s;
+ s.n = 0;
+ s.size = 16;
+ s.items = checked_malloc(s.size * sizeof(T_stm));
+ return s;
+}
+
+static void push(stmStack *s, T_stm stm)
+{
+ if (s->n == s->size) {
+   T_stm *grown = checked_malloc(2 * s->size * sizeof(T_stm));
+   memcpy(grown, s->items, s->n * sizeof(T_stm));
+   free(s->items);
+   s->items = grown;
+   s->size *= 2;
+ }
+ s->items[s->n++] = stm;
+}
 
 static expRefList ExpRefList(T_exp *head, expRefList tail)
 {expRefList p = (expRefList) checked_malloc (sizeof *p);
@@ -35,11 +60,103 @@ static T_stm seq(T_stm x, T_stm y)
  return T_Seq(x,y);
 }
 
+/*
+ * Effects of a statement on what an expression can observe: the temps it
+ * writes, and whether it writes memory. A call may write any memory, and
+ * every machine register but the frame pointer.
+ */
+struct effects {Temp_tempList temps; bool mem, call;};
+
+static void expEffects(T_exp e, struct effects *eff)
+{
+    switch (e->kind) {
+        case T_BINOP:
+            expEffects(e->u.BINOP.left, eff);
+            expEffects(e->u.BINOP.right, eff);
+            break;
+        case T_MEM:
+            expEffects(e->u.MEM, eff);
+            break;
+        case T_ESEQ:
+            // Not left by do_stm, but kept correct anyway
+            eff->mem = eff->call = TRUE;
+            break;
+        case T_CALL:
+            eff->mem = eff->call = TRUE;
+            break;
+        default:
+            break;
+    }
+}
+
+static void stmEffects(T_stm s, struct effects *eff)
+{
+    switch (s->kind) {
+        case T_SEQ:
+            stmEffects(s->u.SEQ.left, eff);
+            stmEffects(s->u.SEQ.right, eff);
+            break;
+        case T_MOVE:
+            if (s->u.MOVE.dst->kind == T_TEMP) {
+                eff->temps = Temp_TempList(s->u.MOVE.dst->u.TEMP, eff->temps);
+            } else {
+                eff->mem = TRUE;
+                expEffects(s->u.MOVE.dst, eff);
+            }
+            expEffects(s->u.MOVE.src, eff);
+            break;
+        case T_EXP:
+            expEffects(s->u.EXP, eff);
+            break;
+        case T_CJUMP:
+            expEffects(s->u.CJUMP.left, eff);
+            expEffects(s->u.CJUMP.right, eff);
+            break;
+        case T_JUMP:
+            expEffects(s->u.JUMP.exp, eff);
+            break;
+        default:
+            break;
+    }
+}
+
+static bool writes(struct effects *eff, Temp_temp t)
+{
+    if (eff->call && t != F_FP() && Temp_look(F_TempMap(), t)) {
+        return TRUE;
+    }
+    for (Temp_tempList l = eff->temps; l; l = l->tail) {
+        if (l->head == t) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Whether y reads nothing eff writes, so that it may be evaluated before it
+static bool independent(T_exp y, struct effects *eff)
+{
+    switch (y->kind) {
+        case T_CONST: case T_NAME:
+            return TRUE;
+        case T_TEMP:
+            return !writes(eff, y->u.TEMP);
+        case T_BINOP:
+            return independent(y->u.BINOP.left, eff) && independent(y->u.BINOP.right, eff);
+        case T_MEM:
+            return !eff->mem && independent(y->u.MEM, eff);
+        default:
+            return FALSE;
+    }
+}
+
 static bool commute(T_stm x, T_exp y)
 {
- if (isNop(x)) return TRUE;
- if (y->kind == T_NAME || y->kind == T_CONST) return TRUE;
- return FALSE;
+    if (isNop(x)) return TRUE;
+    if (y->kind == T_NAME || y->kind == T_CONST) return TRUE;
+    struct effects eff = {NULL, FALSE, FALSE};
+    stmEffects(x, &eff);
+    return independent(y, &eff);
 }
 
 struct stmExp {T_stm s; T_exp e;};
@@ -48,6 +165,7 @@ static T_stm reorder(expRefList rlist) {
    if (!rlist) return T_Exp(T_Const(0)); /* nop */
    else if ((*rlist->head)->kind==T_CALL) {
       Temp_temp t = Temp_newtemp();
+      t->pointer = T_isPointer(*rlist->head);
       *rlist->head = T_Eseq(T_Move(T_Temp(t),*rlist->head),T_Temp(t));
       return reorder(rlist);
     }
@@ -59,6 +177,7 @@ static T_stm reorder(expRefList rlist) {
          return seq(hd.s,s);
       } else {
         Temp_temp t = Temp_newtemp();
+        t->pointer = T_isPointer(hd.e);
         *rlist->head=T_Temp(t);
         return seq(hd.s, seq(T_Move(T_Temp(t),hd.e), s));
       }
@@ -92,8 +211,12 @@ static struct stmExp do_exp(T_exp exp)
   case T_MEM: 
     return StmExp(reorder(ExpRefList(&exp->u.MEM, NULL)), exp);
   case T_ESEQ:
-    {struct stmExp x = do_exp(exp->u.ESEQ.exp);
-     return StmExp(seq(do_stm(exp->u.ESEQ.stm), x.s), x.e);
+    {/* a chain of ESEQs is walked down, not recursed into */
+     T_stm s = T_Exp(T_Const(0));
+     for (; exp->kind == T_ESEQ; exp = exp->u.ESEQ.exp)
+       s = seq(s, do_stm(exp->u.ESEQ.stm));
+     struct stmExp x = do_exp(exp);
+     return StmExp(seq(s, x.s), x.e);
     }
   case T_CALL:    
       return StmExp(reorder(get_call_rlist(exp)), exp);
@@ -106,8 +229,22 @@ static struct stmExp do_exp(T_exp exp)
 static T_stm do_stm(T_stm stm)
 {
   switch (stm->kind) {
-  case T_SEQ: 
-    return seq(do_stm(stm->u.SEQ.left), do_stm(stm->u.SEQ.right));
+  case T_SEQ:
+    {/* the SEQs are flattened with an explicit stack, as a function body may hold many thousands */
+     T_stm result = T_Exp(T_Const(0));
+     stmStack stack = StmStack();
+     push(&stack, stm);
+     while (stack.n) {
+       T_stm s = stack.items[--stack.n];
+       if (s->kind == T_SEQ) {
+         push(&stack, s->u.SEQ.right);
+         push(&stack, s->u.SEQ.left);
+       }
+       else result = seq(result, do_stm(s));
+     }
+     free(stack.items);
+     return result;
+    }
   case T_JUMP:
     return seq(reorder(ExpRefList(&stm->u.JUMP.exp, NULL)), stm);
   case T_CJUMP:
@@ -136,12 +273,21 @@ static T_stm do_stm(T_stm stm)
  }
 }
 
-/* linear gets rid of the top-level SEQ's, producing a list */
+/* linear gets rid of the top-level SEQ's, producing a list; the rightmost statement is consed first */
 static T_stmList linear(T_stm stm, T_stmList right)
 {
- if (stm->kind == T_SEQ) 
-   return linear(stm->u.SEQ.left,linear(stm->u.SEQ.right,right));
- else return T_StmList(stm, right);
+ stmStack stack = StmStack();
+ push(&stack, stm);
+ while (stack.n) {
+   T_stm s = stack.items[--stack.n];
+   if (s->kind == T_SEQ) {
+     push(&stack, s->u.SEQ.left);
+     push(&stack, s->u.SEQ.right);
+   }
+   else right = T_StmList(s, right);
+ }
+ free(stack.items);
+ return right;
 }
 
 /* From an arbitrary Tree statement, produce a list of cleaned trees
@@ -159,42 +305,43 @@ static C_stmListList StmListList(T_stmList head, C_stmListList tail)
  return p;
 }
  
-/* Go down a list looking for end of basic block */
-static C_stmListList next(T_stmList prevstms, T_stmList stms, Temp_label done)
-{
-  if (!stms) 
-    return next(prevstms, 
-		T_StmList(T_Jump(T_Name(done), Temp_LabelList(done, NULL)), 
-			  NULL), done);
-  if (stms->head->kind == T_JUMP || stms->head->kind == T_CJUMP) {
-    C_stmListList stmLists;
-    prevstms->tail = stms; 
-    stmLists = mkBlocks(stms->tail, done);
-    stms->tail = NULL;
-    return stmLists;
-  } 
-  else if (stms->head->kind == T_LABEL) {
-    Temp_label lab = stms->head->u.LABEL;
-    return next(prevstms, T_StmList(T_Jump(T_Name(lab), Temp_LabelList(lab, NULL)), 
-			     stms), done);
-  }
-  else {
-    prevstms->tail = stms;
-    return next(stms, stms->tail, done);
-  }
-}
-
-/* Create the beginning of a basic block */
+/* Cut stms into basic blocks, in one pass over the list */
 static C_stmListList mkBlocks(T_stmList stms, Temp_label done)
 {
-  if (!stms) { 
-    return NULL;
-  }
-  if (stms->head->kind != T_LABEL) {
-    return mkBlocks(T_StmList(T_Label(Temp_newlabel()), stms), done);
-  }
-  /* else there already is a label */
-  return StmListList(stms, next(stms, stms->tail, done));
+    C_stmListList blocks = NULL, last_block = NULL;
+    T_stmList last = NULL;  /* last statement of the open block, NULL if none is open */
+    while (stms || last) {
+        if (!last) {
+            /* Begin a block, with a label */
+            if (stms->head->kind != T_LABEL) {
+                stms = T_StmList(T_Label(Temp_newlabel()), stms);
+            }
+            C_stmListList block = StmListList(stms, NULL);
+            if (last_block) {
+                last_block->tail = block;
+            } else {
+                blocks = block;
+            }
+            last_block = block;
+            last = stms;
+            stms = stms->tail;
+        } else if (!stms || stms->head->kind == T_LABEL) {
+            /* End the block by a jump to the label that follows */
+            Temp_label lab = stms ? stms->head->u.LABEL : done;
+            last->tail = T_StmList(T_Jump(T_Name(lab), Temp_LabelList(lab, NULL)), NULL);
+            last = NULL;
+        } else {
+            T_stm s = stms->head;
+            last->tail = stms;
+            last = stms;
+            stms = stms->tail;
+            if (s->kind == T_JUMP || s->kind == T_CJUMP) {
+                last->tail = NULL;
+                last = NULL;
+            }
+        }
+    }
+    return blocks;
 }
 
         /* basicBlocks : Tree.stm list -> (Tree.stm list list * Tree.label)
@@ -217,73 +364,49 @@ struct C_block C_basicBlocks(T_stmList stmList)
   return b;
 }
 
-static S_table block_env;
-static struct C_block global_block;
+/*
+ * Blocks by the number of their label, which is faster than a symbol table on
+ * large functions. Each schedule indexes the blocks it works on, and unindexes
+ * them once done, so the array is shared.
+ */
+static int *label_block = NULL;
+static int label_blocks = 0;
 
-static T_stmList getLast(T_stmList list)
+static void indexBlock(Temp_label lab, int i)
 {
-  T_stmList last = list;
-  while (last->tail->tail) last = last->tail;
-  return last;
+    if (lab->num >= label_blocks) {
+        int size = 2 * S_count() + 64;
+        int *grown = checked_malloc(size * sizeof(int));
+        for (int k = 0; k < size; k++) {
+            grown[k] = k < label_blocks ? label_block[k] : 0;
+        }
+        free(label_block);
+        label_block = grown;
+        label_blocks = size;
+    }
+    label_block[lab->num] = i + 1;
 }
 
-static void trace(T_stmList list)
+static void unindexBlock(Temp_label lab)
 {
-  T_stmList last = getLast(list);
-  T_stm lab = list->head;
-  T_stm s = last->tail->head;
-  S_enter(block_env, lab->u.LABEL, NULL);
-  if (s->kind == T_JUMP) {
-    T_stmList target = (T_stmList) S_look(block_env, s->u.JUMP.jumps->head);
-    if (!s->u.JUMP.jumps->tail && target) {
-      last->tail = target; /* merge the 2 lists removing JUMP stm */
-      trace(target);
-    }
-    else last->tail->tail = getNext(); /* merge and keep JUMP stm */
-  }
-  /* we want false label to follow CJUMP */
-  else if (s->kind == T_CJUMP) {
-    T_stmList true =  (T_stmList) S_look(block_env, s->u.CJUMP.true);
-    T_stmList false =  (T_stmList) S_look(block_env, s->u.CJUMP.false);
-    if (false) {
-      last->tail->tail = false;
-      trace(false);
-    }
-    else if (true) { /* convert so that existing label is a false label */
-      last->tail->head = T_Cjump(T_notRel(s->u.CJUMP.op), s->u.CJUMP.left,
-				 s->u.CJUMP.right, s->u.CJUMP.false, 
-				 s->u.CJUMP.true);
-      last->tail->tail = true;
-      trace(true);
-    }
-    else {
-      Temp_label false = Temp_newlabel();
-      last->tail->head = T_Cjump(s->u.CJUMP.op, s->u.CJUMP.left,
-				 s->u.CJUMP.right, s->u.CJUMP.true, false);
-      last->tail->tail = T_StmList(T_Label(false), getNext());
+    if (lab->num < label_blocks) {
+        label_block[lab->num] = 0;
     }
-  }
-  else assert(0);
 }
 
-/* get the next block from the list of stmLists, using only those that have
- * not been traced yet */
-static T_stmList getNext()
+/* The block labelled lab, or -1 */
+static int indexOf(Temp_label lab)
 {
-  if (!global_block.stmLists)
-    return T_StmList(T_Label(global_block.label), NULL);
-  else {
-    T_stmList s = global_block.stmLists->head;
-    if (S_look(block_env, s->head->u.LABEL)) {/* label exists in the table */
-      trace(s);
-      return s;
-    }
-    else {
-      global_block.stmLists = global_block.stmLists->tail;
-      return getNext();
-    }
-  }
+    return lab->num < label_blocks ? label_block[lab->num] - 1 : -1;
 }
+
+static T_stmList getLast(T_stmList list)
+{
+  T_stmList last = list;
+  while (last->tail->tail) last = last->tail;
+  return last;
+}
+
          /* traceSchedule : Tree.stm list list * Tree.label -> Tree.stm list
             From a list of basic blocks satisfying properties 1-6,
             along with an "exit" label,
@@ -295,14 +418,586 @@ static T_stmList getNext()
             as possible are eliminated by falling through into T.LABEL(lab).
          */
 T_stmList C_traceSchedule(struct C_block b)
-{ C_stmListList sList;
-  block_env = S_empty();
-  global_block = b;
+{
+    int n = 0;
+    for (C_stmListList l = b.stmLists; l; l = l->tail) {
+        n++;
+    }
+    T_stmList *blocks = checked_malloc((n + 1) * sizeof(T_stmList));
+    n = 0;
+    for (C_stmListList l = b.stmLists; l; l = l->tail) {
+        blocks[n] = l->head;
+        indexBlock(l->head->head->u.LABEL, n++);
+    }
 
-  for (sList=global_block.stmLists; sList; sList=sList->tail) {
-    S_enter(block_env, sList->head->head->u.LABEL, sList->head);
-  }
+    /*
+     * Each untraced block in turn starts a trace, which goes on with a successor
+     * not traced yet, preferably the false one of a CJUMP. Traced blocks are
+     * unindexed, and link points at where the next block of the result goes.
+     */
+    T_stmList result = NULL, *link = &result;
+    for (int start = 0; start < n; start++) {
+        for (int i = indexOf(blocks[start]->head->u.LABEL) == start ? start : -1; i >= 0;) {
+            T_stmList list = blocks[i], last = getLast(list);
+            T_stm s = last->tail->head;
+            unindexBlock(list->head->u.LABEL);
+            *link = list;
+            i = -1;
+            if (s->kind == T_JUMP) {
+                int target = s->u.JUMP.jumps->tail ? -1 : indexOf(s->u.JUMP.jumps->head);
+                if (target >= 0) {
+                    link = &last->tail;     /* merge the 2 lists removing JUMP stm */
+                    i = target;
+                }
+                else link = &last->tail->tail;
+            }
+            /* we want false label to follow CJUMP */
+            else if (s->kind == T_CJUMP) {
+                int t = indexOf(s->u.CJUMP.true), f = indexOf(s->u.CJUMP.false);
+                if (f >= 0) {
+                    i = f;
+                }
+                else if (t >= 0) {  /* convert so that existing label is a false label */
+                    last->tail->head = T_Cjump(T_notRel(s->u.CJUMP.op), s->u.CJUMP.left,
+                                               s->u.CJUMP.right, s->u.CJUMP.false,
+                                               s->u.CJUMP.true);
+                    i = t;
+                }
+                else {
+                    Temp_label false = Temp_newlabel();
+                    last->tail->head = T_Cjump(s->u.CJUMP.op, s->u.CJUMP.left,
+                                               s->u.CJUMP.right, s->u.CJUMP.true, false);
+                    last->tail->tail = T_StmList(T_Label(false),
+                                                 T_StmList(T_Jump(T_Name(s->u.CJUMP.false),
+                                                                  Temp_LabelList(s->u.CJUMP.false, NULL)), NULL));
+                    link = &last->tail->tail->tail->tail;
+                    continue;
+                }
+                link = &last->tail->tail;
+            }
+            else assert(0);
+        }
+    }
+    *link = T_StmList(T_Label(b.label), NULL);
+    free(blocks);
+    return result;
+}
+
+
+/*
+ * Loop-aware layout
+ *
+ * The blocks form a flow graph, whose natural loops are found from the back edges
+ * of a depth-first search. Blocks are then laid out in chains, each block followed
+ * by the successor that stays in its innermost loop, and calls to functions that
+ * do not return mark cold blocks, which go last.
+ *
+ * A loop entered by a jump to a header that tests the exit condition is rotated:
+ * the chain continues at the first block of the body instead, so that the header
+ * ends up below the body, and each iteration takes only the branch back to the top.
+ * Likewise a block that only jumps back to the header from the exit test goes
+ * above the header, so that the test branches to it and it falls into the header.
+ */
+
+typedef struct {
+    int n;
+    T_stmList *stms;        // Statements of each block, label first
+    int (*succ)[2];         // Successors; for a CJUMP, false first
+    int *n_succ;
+    bool *taken;            // For the estimate: whether control jumps to succ[0] (taken[0]) and succ[1]
+    bool *header;           // Whether the block heads a loop
+    int *parent;            // Header of the loop just around the loop headed by the block, or -1
+    int *nesting;           // Number of loops around the loop headed by the block, itself included
+    int **members;          // Blocks of the loop headed by each block in increasing order, ended by -1
+    int *depth;             // Number of loops containing the block
+    int *inner;             // Header of the innermost loop containing the block, or -1
+} cfg;
+
+static string noReturn[] = {"exit", NULL};
+
+static cfg newCfg(int n) {
+    cfg g;
+    g.n = n;
+    g.stms = checked_malloc((n + 1) * sizeof(T_stmList));
+    g.succ = checked_malloc((n + 1) * sizeof(*g.succ));
+    g.n_succ = checked_malloc((n + 1) * sizeof(int));
+    g.taken = checked_malloc((2 * n + 1) * sizeof(bool));
+    g.header = checked_malloc((n + 1) * sizeof(bool));
+    g.parent = checked_malloc((n + 1) * sizeof(int));
+    g.nesting = checked_malloc((n + 1) * sizeof(int));
+    g.members = checked_malloc((n + 1) * sizeof(int *));
+    g.depth = checked_malloc((n + 1) * sizeof(int));
+    g.inner = checked_malloc((n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        g.n_succ[i] = 0;
+        g.taken[2 * i] = g.taken[2 * i + 1] = FALSE;
+        g.header[i] = FALSE;
+        g.parent[i] = -1;
+        g.members[i] = NULL;
+    }
+    return g;
+}
+
+static void addSucc(cfg *g, int b, Temp_label lab, bool taken) {
+    int s = indexOf(lab);
+    if (s >= 0 && g->n_succ[b] < 2) {
+        g->taken[2 * b + g->n_succ[b]] = taken;
+        g->succ[b][g->n_succ[b]++] = s;
+    }
+}
 
-  return getNext();
+static int *loop_size;
+
+static int bySize(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return loop_size[x] != loop_size[y] ? loop_size[x] - loop_size[y] : x - y;
+}
+
+static int byIndex(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * Find the natural loops from the back edges of a depth-first search, and nest
+ * them into a tree: a loop is inside the smallest loop containing its header.
+ */
+static void findLoops(cfg *g) {
+    int n = g->n;
+    int *state = checked_malloc((n + 1) * sizeof(int));
+    int *back = checked_malloc((n + 1) * sizeof(int));
+    int *stack = checked_malloc((n + 1) * sizeof(int));
+    int *next_succ = checked_malloc((n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        state[i] = 0;
+        back[i] = 0;
+    }
+
+    // Mark back edges b -> h, as back[b] holding the bit of k for succ[b][k]
+    int top = 0;
+    if (n) {
+        stack[top++] = 0;
+        state[0] = 1;
+        next_succ[0] = 0;
+    }
+    while (top) {
+        int b = stack[top - 1];
+        if (next_succ[b] == g->n_succ[b]) {
+            state[b] = 2;
+            top--;
+            continue;
+        }
+        int k = next_succ[b]++, h = g->succ[b][k];
+        if (state[h] == 0) {
+            state[h] = 1;
+            next_succ[h] = 0;
+            stack[top++] = h;
+        } else if (state[h] == 1) {
+            back[b] |= 1 << k;
+            g->header[h] = TRUE;
+        }
+    }
+
+    // Predecessors, as lists in one array
+    int *pred_start = checked_malloc((n + 2) * sizeof(int));
+    int *preds = checked_malloc((2 * n + 1) * sizeof(int));
+    for (int i = 0; i <= n; i++) {
+        pred_start[i] = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < g->n_succ[i]; k++) {
+            pred_start[g->succ[i][k] + 1]++;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        pred_start[i + 1] += pred_start[i];
+        next_succ[i] = pred_start[i];
+    }
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < g->n_succ[i]; k++) {
+            preds[next_succ[g->succ[i][k]]++] = i;
+        }
+    }
+
+    // The loop of h is h and every reachable block reaching a back edge into h without passing h
+    int *mark = checked_malloc((n + 1) * sizeof(int));
+    int *headers = checked_malloc((n + 1) * sizeof(int)), n_headers = 0;
+    loop_size = checked_malloc((n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        mark[i] = -1;
+    }
+    for (int h = 0; h < n; h++) {
+        if (!g->header[h]) {
+            continue;
+        }
+        headers[n_headers++] = h;
+        int size = 0;
+        mark[h] = h;
+        stack[size++] = h;
+        for (int j = pred_start[h]; j < pred_start[h + 1]; j++) {
+            int b = preds[j];
+            for (int k = 0; k < g->n_succ[b]; k++) {
+                if ((back[b] & (1 << k)) && g->succ[b][k] == h && mark[b] != h) {
+                    mark[b] = h;
+                    stack[size++] = b;
+                }
+            }
+        }
+        for (int w = 1; w < size; w++) {
+            int b = stack[w];
+            for (int j = pred_start[b]; j < pred_start[b + 1]; j++) {
+                int p = preds[j];
+                if (state[p] && mark[p] != h) {
+                    mark[p] = h;
+                    stack[size++] = p;
+                }
+            }
+        }
+        g->members[h] = checked_malloc((size + 1) * sizeof(int));
+        memcpy(g->members[h], stack, size * sizeof(int));
+        qsort(g->members[h], size, sizeof(int), byIndex);
+        g->members[h][size] = -1;
+        loop_size[h] = size;
+    }
+
+    // Nest the loops from the smallest up, finding the outermost loop yet of a block by union-find
+    qsort(headers, n_headers, sizeof(int), bySize);
+    int *outer = mark;
+    for (int i = 0; i < n; i++) {
+        g->inner[i] = -1;
+        outer[i] = i;
+    }
+    for (int k = 0; k < n_headers; k++) {
+        int h = headers[k];
+        for (int *m = g->members[h]; *m >= 0; m++) {
+            if (g->inner[*m] < 0) {
+                g->inner[*m] = h;
+                continue;
+            }
+            int r = g->inner[*m];
+            while (outer[r] != r) {
+                outer[r] = outer[outer[r]];
+                r = outer[r];
+            }
+            if (r != h) {
+                g->parent[r] = h;
+                outer[r] = h;
+            }
+        }
+    }
+    for (int k = n_headers - 1; k >= 0; k--) {
+        int h = headers[k];
+        g->nesting[h] = g->parent[h] >= 0 ? g->nesting[g->parent[h]] + 1 : 1;
+    }
+    for (int i = 0; i < n; i++) {
+        g->depth[i] = g->inner[i] >= 0 ? g->nesting[g->inner[i]] : 0;
+    }
+    free(state);
+    free(back);
+    free(stack);
+    free(next_succ);
+    free(pred_start);
+    free(preds);
+    free(mark);
+    free(headers);
+    free(loop_size);
+}
+
+// Whether b is in the loop headed by h, or h is -1
+static bool inLoop(cfg *g, int h, int b) {
+    if (h < 0) {
+        return TRUE;
+    }
+    for (int l = g->inner[b]; l >= 0 && g->nesting[l] >= g->nesting[h]; l = g->parent[l]) {
+        if (l == h) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// The number of loops containing both a and b
+static int sharedLoops(cfg *g, int a, int b) {
+    int x = g->inner[a], y = g->inner[b];
+    while (x != y) {
+        if (x < 0 || y < 0) {
+            return 0;
+        }
+        if (g->nesting[x] >= g->nesting[y]) {
+            x = g->parent[x];
+        } else {
+            y = g->parent[y];
+        }
+    }
+    return x >= 0 ? g->nesting[x] : 0;
+}
+
+static bool callsNoReturn(T_stmList stms) {
+    for (; stms; stms = stms->tail) {
+        T_stm s = stms->head;
+        T_exp e = s->kind == T_EXP ? s->u.EXP : s->kind == T_MOVE ? s->u.MOVE.src : NULL;
+        if (e && e->kind == T_CALL && e->u.CALL.fun->kind == T_NAME) {
+            for (string *f = noReturn; *f; f++) {
+                if (!strcmp(S_name(e->u.CALL.fun->u.NAME), *f)) {
+                    return TRUE;
+                }
+            }
+        }
+    }
+    return FALSE;
+}
+
+static cfg layout_cfg;
+static bool *cold, *placed;
+static int *order, n_order;
+
+// Where chainStart resumes its scans: of the blocks, of the cold blocks, and of the members of each loop
+static int next_hot, next_cold, *next_member;
+
+// The first block of the body of the loop headed by h, if h is a test that exits the loop
+static int loopTop(int h) {
+    cfg *g = &layout_cfg;
+    if (!g->header[h] || g->n_succ[h] != 2 || getLast(g->stms[h])->tail->head->kind != T_CJUMP) {
+        return -1;
+    }
+    bool in0 = inLoop(g, h, g->succ[h][0]), in1 = inLoop(g, h, g->succ[h][1]);
+    if (in0 == in1) {
+        return -1;
+    }
+    int top = in0 ? g->succ[h][0] : g->succ[h][1];
+    return top != h ? top : -1;
+}
+
+/*
+ * The block that only jumps back to the header h from an exit test of the loop,
+ * as the increment of a for loop does, or -1. Placed above h, it falls into it,
+ * and the test branches back to it.
+ */
+static int loopLatch(int h) {
+    cfg *g = &layout_cfg;
+    for (int *m = g->members[h]; *m >= 0; m++) {
+        int x = *m;
+        if (g->n_succ[x] != 2) {
+            continue;
+        }
+        for (int k = 0; k < 2; k++) {
+            int p = g->succ[x][k], exit = g->succ[x][1 - k];
+            if (p != h && g->n_succ[p] == 1 && g->succ[p][0] == h && inLoop(g, h, p) && !inLoop(g, h, exit)) {
+                return p;
+            }
+        }
+    }
+    return -1;
+}
+
+// The block to place after b in its chain, or -1 to end the chain
+static int follower(int b) {
+    cfg *g = &layout_cfg;
+    int best = -1;
+    bool best_stays = FALSE;
+    for (int k = 0; k < g->n_succ[b]; k++) {
+        int s = g->succ[b][k];
+        if (cold[s] && !cold[b]) {
+            continue;
+        }
+        // Rotate a loop entered by a jump to its header
+        if (g->n_succ[b] == 1 && g->header[s] && !inLoop(g, s, b) && !placed[s]) {
+            int top = loopTop(s);
+            if (top >= 0 && !placed[top]) {
+                return top;
+            }
+        }
+        // Put the latch of a loop entered from b above its header
+        if (g->header[s] && !inLoop(g, s, b) && !placed[s]) {
+            int latch = loopLatch(s);
+            if (latch >= 0 && !placed[latch]) {
+                return latch;
+            }
+        }
+        if (placed[s]) {
+            continue;
+        }
+        // Stay in the loop of b if possible, and otherwise enter a loop rather than leave one
+        bool stays = inLoop(g, g->inner[b], s);
+        if (best < 0 || (stays && !best_stays) || (stays == best_stays && g->depth[s] > g->depth[best])) {
+            best = s;
+            best_stays = stays;
+        }
+    }
+    return best;
+}
+
+/*
+ * The block to start the next chain with, preferring the loop of the last one placed.
+ * Blocks skipped by a scan are placed, cold or in another loop for good, so scans resume.
+ */
+static int chainStart(int last) {
+    cfg *g = &layout_cfg;
+    int h = last >= 0 ? g->inner[last] : -1;
+    if (h >= 0) {
+        int *m = g->members[h];
+        for (; m[next_member[h]] >= 0; next_member[h]++) {
+            int i = m[next_member[h]];
+            if (!placed[i] && !cold[i] && g->inner[i] == h) {
+                return i;
+            }
+        }
+    }
+    for (; next_hot < g->n; next_hot++) {
+        if (!placed[next_hot] && !cold[next_hot]) {
+            return next_hot;
+        }
+    }
+    for (; next_cold < g->n; next_cold++) {
+        if (!placed[next_cold]) {
+            return next_cold;
+        }
+    }
+    return -1;
+}
+
+T_stmList C_layoutSchedule(struct C_block b)
+{
+    int n = 0;
+    for (C_stmListList l = b.stmLists; l; l = l->tail) {
+        n++;
+    }
+    layout_cfg = newCfg(n);
+    cfg *g = &layout_cfg;
+    n = 0;
+    for (C_stmListList l = b.stmLists; l; l = l->tail) {
+        g->stms[n] = l->head;
+        indexBlock(l->head->head->u.LABEL, n);
+        n++;
+    }
+    cold = checked_malloc((n + 1) * sizeof(bool));
+    placed = checked_malloc((n + 1) * sizeof(bool));
+    order = checked_malloc((n + 1) * sizeof(int));
+    next_member = checked_malloc((n + 1) * sizeof(int));
+    n_order = next_hot = next_cold = 0;
+    for (int i = 0; i < n; i++) {
+        T_stm s = getLast(g->stms[i])->tail->head;
+        if (s->kind == T_CJUMP) {
+            addSucc(g, i, s->u.CJUMP.false, FALSE);
+            addSucc(g, i, s->u.CJUMP.true, TRUE);
+        } else {
+            for (Temp_labelList l = s->u.JUMP.jumps; l; l = l->tail) {
+                addSucc(g, i, l->head, TRUE);
+            }
+        }
+        cold[i] = callsNoReturn(g->stms[i]);
+        placed[i] = FALSE;
+        next_member[i] = 0;
+    }
+    findLoops(g);
+    for (int i = 0; i < n; i++) {
+        unindexBlock(g->stms[i]->head->u.LABEL);
+    }
+
+    // Lay out the chains
+    for (int start = n ? 0 : -1; start >= 0; start = chainStart(order[n_order - 1])) {
+        for (int i = start; i >= 0 && !placed[i]; i = follower(i)) {
+            placed[i] = TRUE;
+            order[n_order++] = i;
+        }
+    }
+
+    // Link the blocks, so that each CJUMP is followed by its false label, dropping jumps to the next block
+    T_stmList result = NULL, tail = NULL;
+    for (int k = 0; k < n_order; k++) {
+        T_stmList stms = g->stms[order[k]], last = getLast(stms);
+        Temp_label next = k + 1 < n_order ? g->stms[order[k + 1]]->head->u.LABEL : b.label;
+        T_stm s = last->tail->head;
+        if (s->kind == T_JUMP) {
+            if (!s->u.JUMP.jumps->tail && s->u.JUMP.jumps->head == next) {
+                last->tail = NULL;
+            }
+        } else if (s->u.CJUMP.true == next) {
+            last->tail->head = T_Cjump(T_notRel(s->u.CJUMP.op), s->u.CJUMP.left, s->u.CJUMP.right,
+                                       s->u.CJUMP.false, s->u.CJUMP.true);
+        } else if (s->u.CJUMP.false != next) {
+            Temp_label false = Temp_newlabel();
+            last->tail->head = T_Cjump(s->u.CJUMP.op, s->u.CJUMP.left, s->u.CJUMP.right, s->u.CJUMP.true, false);
+            last->tail->tail = T_StmList(T_Label(false),
+                                         T_StmList(T_Jump(T_Name(s->u.CJUMP.false),
+                                                          Temp_LabelList(s->u.CJUMP.false, NULL)), NULL));
+        }
+        if (!result) {
+            result = stms;
+        } else {
+            tail->tail = stms;
+        }
+        for (tail = stms; tail->tail; tail = tail->tail);
+    }
+    T_stmList done = T_StmList(T_Label(b.label), NULL);
+    if (!result) {
+        return done;
+    }
+    tail->tail = done;
+    return result;
 }
 
+double C_takenBranches(T_stmList stms)
+{
+    int n = 0;
+    for (T_stmList l = stms; l; l = l->tail) {
+        n += l->head->kind == T_LABEL;
+    }
+    cfg g = newCfg(n);
+    n = 0;
+    for (T_stmList l = stms; l; l = l->tail) {
+        if (l->head->kind == T_LABEL) {
+            g.stms[n] = l;
+            indexBlock(l->head->u.LABEL, n);
+            n++;
+        }
+    }
+
+    // Control leaves a block by its last statement, or falls into the next label
+    for (int i = 0; i < n; i++) {
+        T_stmList last = g.stms[i];
+        while (last->tail && last->tail->head->kind != T_LABEL) {
+            last = last->tail;
+        }
+        T_stm s = last->head;
+        if (s->kind == T_JUMP) {
+            for (Temp_labelList l = s->u.JUMP.jumps; l; l = l->tail) {
+                addSucc(&g, i, l->head, TRUE);
+            }
+        } else if (s->kind == T_CJUMP) {
+            addSucc(&g, i, s->u.CJUMP.false, FALSE);
+            addSucc(&g, i, s->u.CJUMP.true, TRUE);
+        } else if (last->tail) {
+            addSucc(&g, i, last->tail->head->u.LABEL, FALSE);
+        }
+    }
+    findLoops(&g);
+    for (int i = 0; i < n; i++) {
+        unindexBlock(g.stms[i]->head->u.LABEL);
+    }
+
+    // An edge runs 10 times per loop around both its ends, shared evenly by the successors in the most loops
+    double taken = 0;
+    for (int i = 0; i < n; i++) {
+        int shared[2] = {0, 0}, top = 0;
+        for (int k = 0; k < g.n_succ[i]; k++) {
+            shared[k] = sharedLoops(&g, i, g.succ[i][k]);
+            if (shared[k] > top) {
+                top = shared[k];
+            }
+        }
+        int ties = 0;
+        for (int k = 0; k < g.n_succ[i]; k++) {
+            ties += shared[k] == top;
+        }
+        for (int k = 0; k < g.n_succ[i]; k++) {
+            if (g.taken[2 * i + k]) {
+                double freq = 1;
+                for (int d = 0; d < shared[k]; d++) {
+                    freq *= 10;
+                }
+                taken += shared[k] == top ? freq / ties : freq;
+            }
+        }
+    }
+    return taken;
+}
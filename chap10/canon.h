@@ -39,3 +39,15 @@ T_stmList C_traceSchedule(struct C_block b);
             as possible are eliminated by falling through into T.LABEL(lab).
          */
 
+
+T_stmList C_layoutSchedule(struct C_block b);
+        /* Like traceSchedule, but lays out loop bodies contiguously, with the
+           exit test of a loop at its bottom when the loop is entered by a jump
+           to it, and blocks calling functions that do not return last.
+        */
+
+double C_takenBranches(T_stmList stmList);
+        /* Static estimate of the taken branches of a scheduled stm list, with
+           every loop iterating 10 times and the two ways of a branch alike
+           equally likely.
+        */
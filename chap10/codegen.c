@@ -6,21 +6,17 @@
 /*
  * Code generator framework
  *
- * For easily extending to CSIC instructions, use
- * Dynamic Programming algorithm for instr selection
+ * Instruction selection is a bottom-up rewrite: every node is labelled with the
+ * cheapest rule covering it, children first, then the chosen rules are reduced
+ * top-down by their generators.
  *
- * For code generation, you must define <match, gen, cost> pair
- * and store all of them in an array "F_patterns[]"
+ * The rules of an architecture are written in a tree grammar (arch/<arch>/<arch>.brg)
+ * and compiled by tools/burg into the labellers F_matchExp/F_matchStm and the
+ * table F_rules[] of generators.
  */
 
 static AS_instrList instrs = NULL, instrs_tail = NULL;
 
-static void findOptimalExp(T_exp exp);
-static void findOptimalStm(T_stm stm);
-
-extern F_pattern F_patterns[];
-extern int F_nPattern;
-
 void F_emit(AS_instr inst) {
     if (instrs == NULL) {
         instrs = instrs_tail = AS_InstrList(inst, NULL);
@@ -30,129 +26,81 @@ void F_emit(AS_instr inst) {
     }
 }
 
-/*
- * Use dynamic programming to find optimum coverage method
- */
-
-static void findOptimalExp(T_exp exp) {
-    exp->cost = -1;
-    exp->selection = -1;
+int F_argsCost(T_expList args) {
+    int cost = 0;
+    for (; args; args = args->tail) {
+        cost += args->head->cost;
+    }
+    return cost;
+}
 
-    // Bottom up DP
+static void labelExp(T_exp exp) {
     switch (exp->kind) {
         case T_BINOP:
-            findOptimalExp(exp->u.BINOP.left);
-            findOptimalExp(exp->u.BINOP.right);
+            labelExp(exp->u.BINOP.left);
+            labelExp(exp->u.BINOP.right);
             break;
         case T_MEM:
-            findOptimalExp(exp->u.MEM);
+            labelExp(exp->u.MEM);
             break;
         case T_ESEQ:
             // No ESEQ must exist in this pass
             assert(0);
             break;
         case T_CALL:
-            findOptimalExp(exp->u.CALL.fun);
+            labelExp(exp->u.CALL.fun);
             for (T_expList args = exp->u.CALL.args; args; args = args->tail) {
-                findOptimalExp(args->head);
+                labelExp(args->head);
             }
             break;
 
         default: ;
     }
-
-    for (int i = 0; i < F_nPattern; i++) {
-        if (F_patterns[i].kind != PAT_EXP) {
-            continue;
-        }
-
-        bool matched = FALSE;
-        T_expList res = F_patterns[i].matcher.exp(exp, &matched);
-        if (!matched) {
-            continue;
-        }
-
-        int total_cost = 0;
-        for (T_expList exps = res; exps; exps = exps->tail) {
-            total_cost += exps->head->cost;
-        }
-        total_cost += F_patterns[i].cost;
-
-        if (exp->cost == -1 || total_cost < exp->cost) {
-            exp->cost = total_cost;
-            exp->selection = i;
-        }
-    }
+    F_matchExp(exp);
 }
 
-static void findOptimalStm(T_stm stm) {
-    stm->cost = -1;
-    stm->selection = -1;
-
-    // Bottom up DP
+static void labelStm(T_stm stm) {
     switch (stm->kind) {
         case T_SEQ:
             // No SEQ must exist in this pass
             assert(0);
             break;
         case T_JUMP:
-            findOptimalExp(stm->u.JUMP.exp);
+            labelExp(stm->u.JUMP.exp);
             break;
         case T_CJUMP:
-            findOptimalExp(stm->u.CJUMP.left);
-            findOptimalExp(stm->u.CJUMP.right);
+            labelExp(stm->u.CJUMP.left);
+            labelExp(stm->u.CJUMP.right);
             break;
         case T_MOVE:
             // Tree IR only supports MOVE(TEMP, e) or MOVE(MEM(e'), e)
             assert(stm->u.MOVE.dst->kind == T_TEMP || stm->u.MOVE.dst->kind == T_MEM);
-            findOptimalExp(stm->u.MOVE.dst);
-            findOptimalExp(stm->u.MOVE.src);
+            labelExp(stm->u.MOVE.dst);
+            labelExp(stm->u.MOVE.src);
             break;
         case T_EXP:
-            findOptimalExp(stm->u.EXP);
+            labelExp(stm->u.EXP);
             break;
 
         default: ;
     }
-
-    for (int i = 0; i < F_nPattern; i++) {
-        if (F_patterns[i].kind != PAT_STM) {
-            continue;
-        }
-
-        bool matched = FALSE;
-        T_expList res = F_patterns[i].matcher.stm(stm, &matched);
-        if (!matched) {
-            continue;
-        }
-
-        int total_cost = 0;
-        for (T_expList exps = res; exps; exps = exps->tail) {
-            total_cost += exps->head->cost;
-        }
-        total_cost += F_patterns[i].cost;
-
-        if (stm->cost == -1 || total_cost < stm->cost) {
-            stm->cost = total_cost;
-            stm->selection = i;
-        }
-    }
+    F_matchStm(stm);
 }
 
 Temp_temp F_doExp(T_exp exp) {
-    assert(exp->selection != -1);
-    return F_patterns[exp->selection].gen.exp(exp);
+    assert(exp->selection != -1 && F_rules[exp->selection].kind == RULE_EXP);
+    return F_rules[exp->selection].gen.exp(exp);
 }
 
 void F_doStm(T_stm stm) {
-    assert(stm->selection != -1);
-    F_patterns[stm->selection].gen.stm(stm);
+    assert(stm->selection != -1 && F_rules[stm->selection].kind == RULE_STM);
+    F_rules[stm->selection].gen.stm(stm);
 }
 
 AS_instrList F_codegen(F_frame f, T_stmList stmts) {
     instrs = instrs_tail = NULL;
     for (; stmts; stmts = stmts->tail) {
-        findOptimalStm(stmts->head);
+        labelStm(stmts->head);
         F_doStm(stmts->head);
     }
     return F_procEntryExit2(instrs);
@@ -4,25 +4,32 @@
 #include "assem.h"
 #include "frame.h"
 
-typedef T_expList F_stmMatcher(T_stm, bool* matched);
-typedef T_expList F_expMatcher(T_exp, bool* matched);
 typedef void F_stmGen(T_stm);
 typedef Temp_temp F_expGen(T_exp);
-struct F_pattern_ {
+struct F_rule_ {
     enum {
-        PAT_STM, PAT_EXP
+        RULE_STM, RULE_EXP
     } kind;
-    union {
-        F_stmMatcher* stm;
-        F_expMatcher* exp;
-    } matcher;
     union {
         F_stmGen* stm;
         F_expGen* exp;
     } gen;
-    int cost;
+    string name;
 };
-typedef struct F_pattern_ F_pattern;
+typedef struct F_rule_ F_rule;
+
+/*
+ * Generated by tools/burg from the tree grammar of the architecture:
+ * the rules, and labellers recording the cheapest rule (an index into F_rules)
+ * and its cost in a node whose children are labelled already.
+ */
+extern F_rule F_rules[];
+extern int F_nRule;
+void F_matchExp(T_exp exp);
+void F_matchStm(T_stm stm);
+
+// Total cost of the arguments of a call, for the labellers
+int F_argsCost(T_expList args);
 
 // For code generators
 void F_emit(AS_instr inst);
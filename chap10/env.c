@@ -30,6 +30,14 @@ E_enventry E_EscapeEntry(int level, bool *target) {
     p->kind = E_escapeEntry;
     p->u.escape.level = level;
     p->u.escape.target = target;
+    p->u.escape.no_capture = FALSE;
+    return p;
+}
+
+E_enventry E_EscapeFunEntry(A_fundec fundec) {
+    E_enventry p = checked_malloc(sizeof(*p));
+    p->kind = E_escapeFunEntry;
+    p->u.escapeFun.fundec = fundec;
     return p;
 }
 
@@ -43,9 +51,18 @@ S_table E_base_tenv() {
 S_table E_base_venv() {
     S_table t = S_empty();
     S_enter(t, S_Symbol("print"), E_FunEntry(Ty_TyList(Ty_String(), NULL), Ty_Void(), NULL));
+    S_enter(t, S_Symbol("printi"), E_FunEntry(Ty_TyList(Ty_Int(), NULL), Ty_Void(), NULL));
     S_enter(t, S_Symbol("getchar"), E_FunEntry(NULL, Ty_String(), NULL));
+    S_enter(t, S_Symbol("readline"), E_FunEntry(NULL, Ty_String(), NULL));
+    S_enter(t, S_Symbol("readbytes"), E_FunEntry(Ty_TyList(Ty_Int(), NULL), Ty_String(), NULL));
     S_enter(t, S_Symbol("ord"), E_FunEntry(Ty_TyList(Ty_String(), NULL), Ty_Int(), NULL));
     S_enter(t, S_Symbol("chr"), E_FunEntry(Ty_TyList(Ty_Int(), NULL), Ty_String(), NULL));
+    S_enter(t, S_Symbol("flush"), E_FunEntry(NULL, Ty_Void(), NULL));
+    S_enter(t, S_Symbol("size"), E_FunEntry(Ty_TyList(Ty_String(), NULL), Ty_Int(), NULL));
+    S_enter(t, S_Symbol("substring"), E_FunEntry(Ty_TyList(Ty_String(), Ty_TyList(Ty_Int(), Ty_TyList(Ty_Int(), NULL))),
+                                                 Ty_String(), NULL));
+    S_enter(t, S_Symbol("concat"), E_FunEntry(Ty_TyList(Ty_String(), Ty_TyList(Ty_String(), NULL)), Ty_String(), NULL));
+    S_enter(t, S_Symbol("not"), E_FunEntry(Ty_TyList(Ty_Int(), NULL), Ty_Int(), NULL));
     return t;
 }
 
@@ -2,6 +2,7 @@
 #define TIGER_ENV
 
 #include "symbol.h"
+#include "absyn.h"
 #include "types.h"
 #include "translate.h"
 
@@ -9,7 +10,7 @@ typedef struct E_enventry_ *E_enventry;
 
 struct E_enventry_ {
     enum {
-        E_varEntry, E_funEntry, E_escapeEntry
+        E_varEntry, E_funEntry, E_escapeEntry, E_escapeFunEntry
     } kind;
     union {
         struct {
@@ -25,7 +26,11 @@ struct E_enventry_ {
         struct {
             int level;
             bool *target;
+            bool no_capture;  // Assigned from a nested function, or shadowed by a later binding
         } escape;
+        struct {
+            A_fundec fundec;
+        } escapeFun;
     } u;
 };
 
@@ -37,6 +42,8 @@ E_enventry E_FunEntry(Ty_tyList formals, Ty_ty result, Tr_level level);
 
 E_enventry E_EscapeEntry(int level, bool *target);
 
+E_enventry E_EscapeFunEntry(A_fundec fundec);
+
 S_table E_base_tenv();
 
 S_table E_base_venv();
@@ -39,20 +39,28 @@ void EM_newline(void) {
     linePos = intList(EM_tokPos, linePos);
 }
 
-void EM_error(int pos, char *message, ...) {
-    va_list ap;
+void EM_position(int pos, int *line, int *col) {
     IntList lines = linePos;
     int num = lineNum;
 
-
-    anyErrors = TRUE;
     while (lines && lines->i >= pos) {
         lines = lines->rest;
         num--;
     }
+    *line = lines ? num : 0;
+    *col = lines ? pos - lines->i : 0;
+}
+
+void EM_error(int pos, char *message, ...) {
+    va_list ap;
+    int line, col;
+
+
+    anyErrors = TRUE;
+    EM_position(pos, &line, &col);
 
     if (fileName) fprintf(stderr, "%s:", fileName);
-    if (lines) fprintf(stderr, "%d.%d: ", num, pos - lines->i);
+    if (line) fprintf(stderr, "%d.%d: ", line, col);
     va_start(ap, message);
     vfprintf(stderr, message, ap);
     va_end(ap);
@@ -9,6 +9,9 @@ extern int EM_tokPos;
 
 void EM_error(int, string, ...);
 
+// The line and column of a source position, both 0 if it is before the first token
+void EM_position(int pos, int *line, int *col);
+
 void EM_impossible(string, ...);
 
 void EM_reset(string filename);
@@ -1,140 +1,456 @@
 /*
  * escape.c - escape analysis
+ *
+ * Besides finding the variables that escape, this decides which functions need
+ * a static link at all. A function that refers to no outer variable is lifted to
+ * the top level. Outer variables that no nested function assigns are passed to
+ * the functions reading them as extra arguments (a few per function), which is
+ * safe because they cannot change while such a function runs. Functions that
+ * are never called from the main program do not count at all.
+ * Only variables still read through a static link have to live in the frame.
  */
 
 #include "escape.h"
 #include "absyn.h"
 #include "env.h"
+#include "table.h"
 
-static void visitExp(S_table eenv, int level, A_exp exp);
+// Largest number of outer variables passed as extra arguments
+#define MAX_CAPTURE 3
 
-static void visitDec(S_table eenv, int level, A_dec dec);
+typedef struct escFun_ *escFun;
+typedef struct escFunList_ *escFunList;
+typedef struct escVarList_ *escVarList;
 
-static void visitVar(S_table eenv, int level, A_var var);
+struct escVarList_ {
+    S_symbol name;
+    E_enventry head;
+    escVarList tail;
+};
 
-static void visitDec(S_table eenv, int level, A_dec dec) {
+struct escFunList_ {
+    escFun head;
+    escFunList tail;
+};
+
+struct escFun_ {
+    A_fundec fundec;      // NULL for the main program
+    int level;
+    escFun parent;
+    escVarList vars;      // Variables declared by the function
+    escVarList refs;      // Outer variables used by the function, or on behalf of its children and callees
+    escVarList captured;  // The part of refs passed as arguments
+    escFunList callees;
+    escFunList children;
+    int reach;            // Outermost level whose frame is reached through the static link
+    bool live;            // Reachable by calls from the main program
+};
+
+static escFunList all_funs, all_funs_tail;
+
+static TAB_table fun_map; // Map A_fundec to escFun
+
+static escVarList EscVarList(S_symbol name, E_enventry head, escVarList tail) {
+    escVarList p = checked_malloc(sizeof(*p));
+    p->name = name;
+    p->head = head;
+    p->tail = tail;
+    return p;
+}
+
+static escFunList EscFunList(escFun head, escFunList tail) {
+    escFunList p = checked_malloc(sizeof(*p));
+    p->head = head;
+    p->tail = tail;
+    return p;
+}
+
+static escFun EscFun(A_fundec fundec, escFun parent) {
+    escFun p = checked_malloc(sizeof(*p));
+    p->fundec = fundec;
+    p->level = parent ? parent->level + 1 : 0;
+    p->parent = parent;
+    p->vars = NULL;
+    p->refs = NULL;
+    p->captured = NULL;
+    p->callees = NULL;
+    p->children = NULL;
+    p->reach = p->level;
+    p->live = FALSE;
+    if (parent) {
+        parent->children = EscFunList(p, parent->children);
+        escFunList node = EscFunList(p, NULL);
+        if (!all_funs) {
+            all_funs = all_funs_tail = node;
+        } else {
+            all_funs_tail->tail = node;
+            all_funs_tail = node;
+        }
+        TAB_enter(fun_map, fundec, p);
+    }
+    return p;
+}
+
+static bool inVarList(escVarList vars, E_enventry var) {
+    for (; vars; vars = vars->tail) {
+        if (vars->head == var) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static bool addRef(escFun fun, S_symbol name, E_enventry var) {
+    if (inVarList(fun->refs, var)) {
+        return FALSE;
+    }
+    fun->refs = EscVarList(name, var, fun->refs);
+    return TRUE;
+}
+
+static void addCallee(escFun fun, escFun callee) {
+    for (escFunList callees = fun->callees; callees; callees = callees->tail) {
+        if (callees->head == callee) {
+            return;
+        }
+    }
+    fun->callees = EscFunList(callee, fun->callees);
+}
+
+static bool needsLink(escFun fun) {
+    return fun->reach < fun->level;
+}
+
+/*
+ * Captured variables are looked up by name at the function header during translation,
+ * so a variable shadowed by a later binding is never captured.
+ */
+static void enter(S_table eenv, S_symbol name, E_enventry entry) {
+    E_enventry old = S_look(eenv, name);
+    if (old && old->kind == E_escapeEntry) {
+        old->u.escape.no_capture = TRUE;
+    }
+    S_enter(eenv, name, entry);
+}
+
+static void declare(S_table eenv, escFun fun, S_symbol name, bool *target) {
+    *target = FALSE;
+    E_enventry entry = E_EscapeEntry(fun->level, target);
+    fun->vars = EscVarList(name, entry, fun->vars);
+    enter(eenv, name, entry);
+}
+
+static void visitExp(S_table eenv, escFun fun, A_exp exp);
+
+static void visitDec(S_table eenv, escFun fun, A_dec dec);
+
+static void visitVar(S_table eenv, escFun fun, A_var var);
+
+// Functions in consecutive declarations may call each other, so bind the whole run first
+static void enterFunctions(S_table eenv, escFun fun, A_decList decs) {
+    for (; decs && decs->head->kind == A_functionDec; decs = decs->tail) {
+        for (A_fundecList funs = decs->head->u.function; funs; funs = funs->tail) {
+            EscFun(funs->head, fun);
+            enter(eenv, funs->head->name, E_EscapeFunEntry(funs->head));
+        }
+    }
+}
+
+static void visitDec(S_table eenv, escFun fun, A_dec dec) {
     switch (dec->kind) {
         case A_functionDec:
             for (A_fundecList funs = dec->u.function; funs; funs = funs->tail) {
+                escFun f = TAB_look(fun_map, funs->head);
+                assert(f);
                 S_beginScope(eenv);
                 for (A_fieldList exps = funs->head->params; exps; exps = exps->tail) {
-                    exps->head->escape = FALSE;
-                    S_enter(eenv, exps->head->name, E_EscapeEntry(level + 1, &(exps->head->escape)));
+                    declare(eenv, f, exps->head->name, &(exps->head->escape));
                 }
-                visitExp(eenv, level + 1, funs->head->body);
+                visitExp(eenv, f, funs->head->body);
                 S_endScope(eenv);
             }
             break;
 
         case A_varDec:
-            visitExp(eenv, level, dec->u.var.init);
-            dec->u.var.escape = FALSE;
-            S_enter(eenv, dec->u.var.var, E_EscapeEntry(level, &(dec->u.var.escape)));
+            visitExp(eenv, fun, dec->u.var.init);
+            declare(eenv, fun, dec->u.var.var, &(dec->u.var.escape));
             break;
 
         default:;
     }
 }
 
-static void visitExp(S_table eenv, int level, A_exp exp) {
+static void visitExp(S_table eenv, escFun fun, A_exp exp) {
     switch (exp->kind) {
         case A_varExp:
-            visitVar(eenv, level, exp->u.var);
+            visitVar(eenv, fun, exp->u.var);
             break;
 
-        case A_callExp:
+        case A_callExp: {
+            E_enventry callee = S_look(eenv, exp->u.call.func);
+            if (callee && callee->kind == E_escapeFunEntry) {
+                addCallee(fun, TAB_look(fun_map, callee->u.escapeFun.fundec));
+            }
             for (A_expList args = exp->u.call.args; args; args = args->tail) {
-                visitExp(eenv, level, args->head);
+                visitExp(eenv, fun, args->head);
             }
             break;
+        }
 
         case A_opExp:
-            visitExp(eenv, level, exp->u.op.left);
-            visitExp(eenv, level, exp->u.op.right);
+            visitExp(eenv, fun, exp->u.op.left);
+            visitExp(eenv, fun, exp->u.op.right);
             break;
 
         case A_recordExp:
             for (A_efieldList fields = exp->u.record.fields; fields; fields = fields->tail) {
-                visitExp(eenv, level, fields->head->exp);
+                visitExp(eenv, fun, fields->head->exp);
             }
             break;
 
         case A_seqExp:
             for (A_expList exps = exp->u.seq; exps; exps = exps->tail) {
-                visitExp(eenv, level, exps->head);
+                visitExp(eenv, fun, exps->head);
             }
             break;
 
         case A_assignExp:
-            visitVar(eenv, level, exp->u.assign.var);
-            visitExp(eenv, level, exp->u.assign.exp);
+            visitVar(eenv, fun, exp->u.assign.var);
+            visitExp(eenv, fun, exp->u.assign.exp);
+            if (exp->u.assign.var->kind == A_simpleVar) {
+                E_enventry esc = S_look(eenv, exp->u.assign.var->u.simple);
+                if (esc && esc->kind == E_escapeEntry && esc->u.escape.level < fun->level) {
+                    esc->u.escape.no_capture = TRUE;
+                }
+            }
             break;
 
         case A_ifExp:
-            visitExp(eenv, level, exp->u.iff.test);
-            visitExp(eenv, level, exp->u.iff.then);
+            visitExp(eenv, fun, exp->u.iff.test);
+            visitExp(eenv, fun, exp->u.iff.then);
             if (exp->u.iff.elsee) {
-                visitExp(eenv, level, exp->u.iff.elsee);
+                visitExp(eenv, fun, exp->u.iff.elsee);
             }
             break;
 
         case A_whileExp:
-            visitExp(eenv, level, exp->u.whilee.test);
-            visitExp(eenv, level, exp->u.whilee.body);
+            visitExp(eenv, fun, exp->u.whilee.test);
+            visitExp(eenv, fun, exp->u.whilee.body);
             break;
 
         case A_forExp:
-            visitExp(eenv, level, exp->u.forr.lo);
-            visitExp(eenv, level, exp->u.forr.hi);
-            exp->u.forr.escape = FALSE;
+            visitExp(eenv, fun, exp->u.forr.lo);
+            visitExp(eenv, fun, exp->u.forr.hi);
             S_beginScope(eenv);
-            S_enter(eenv, exp->u.forr.var, E_EscapeEntry(level, &(exp->u.forr.escape)));
-            visitExp(eenv, level, exp->u.forr.body);
+            declare(eenv, fun, exp->u.forr.var, &(exp->u.forr.escape));
+            visitExp(eenv, fun, exp->u.forr.body);
             S_endScope(eenv);
             break;
 
-        case A_letExp:
+        case A_letExp: {
             S_beginScope(eenv);
+            bool in_functions = FALSE;
             for (A_decList decs = exp->u.let.decs; decs; decs = decs->tail) {
-                visitDec(eenv, level, decs->head);
+                if (decs->head->kind == A_functionDec && !in_functions) {
+                    enterFunctions(eenv, fun, decs);
+                }
+                in_functions = decs->head->kind == A_functionDec;
+                visitDec(eenv, fun, decs->head);
             }
-            visitExp(eenv, level, exp->u.let.body);
+            visitExp(eenv, fun, exp->u.let.body);
             S_endScope(eenv);
             break;
+        }
 
         case A_arrayExp:
-            visitExp(eenv, level, exp->u.array.size);
-            visitExp(eenv, level, exp->u.array.init);
+            visitExp(eenv, fun, exp->u.array.size);
+            visitExp(eenv, fun, exp->u.array.init);
             break;
 
         default:;
     }
 }
 
-static void visitVar(S_table eenv, int level, A_var var) {
+static void visitVar(S_table eenv, escFun fun, A_var var) {
     switch (var->kind) {
         case A_simpleVar: {
             E_enventry esc = S_look(eenv, var->u.simple);
-            if (!esc) {
+            if (!esc || esc->kind != E_escapeEntry) {
                 break;
             }
-            assert(esc->kind == E_escapeEntry);
-            if (esc->u.escape.level < level) {
-                *(esc->u.escape.target) = TRUE;
+            if (esc->u.escape.level < fun->level) {
+                addRef(fun, var->u.simple, esc);
             }
             break;
         }
 
         case A_fieldVar:
-            visitVar(eenv, level, var->u.field.var);
+            visitVar(eenv, fun, var->u.field.var);
             break;
 
         case A_subscriptVar:
-            visitVar(eenv, level, var->u.subscript.var);
+            visitVar(eenv, fun, var->u.subscript.var);
             break;
     }
 }
 
-void Esc_findEscape(A_exp exp) {
-    visitExp(E_base_eenv(), 0, exp);
-}
\ No newline at end of file
+static void markLive(escFun fun) {
+    if (fun->live) {
+        return;
+    }
+    fun->live = TRUE;
+    for (escFunList callees = fun->callees; callees; callees = callees->tail) {
+        markLive(callees->head);
+    }
+}
+
+/*
+ * A function must also be able to produce the outer variables that its children
+ * and callees receive from it, so those are added to its own references.
+ */
+static bool inheritRefs(escFun fun, escFun from) {
+    bool changed = FALSE;
+    for (escVarList refs = from->refs; refs; refs = refs->tail) {
+        if (refs->head->u.escape.level < fun->level) {
+            changed |= addRef(fun, refs->name, refs->head);
+        }
+    }
+    return changed;
+}
+
+static void propagateRefs() {
+    bool changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (escFunList funs = all_funs; funs; funs = funs->tail) {
+            escFun f = funs->head;
+            if (!f->live) {
+                continue;
+            }
+            for (escFunList children = f->children; children; children = children->tail) {
+                if (children->head->live) {
+                    changed |= inheritRefs(f, children->head);
+                }
+            }
+            for (escFunList callees = f->callees; callees; callees = callees->tail) {
+                changed |= inheritRefs(f, callees->head);
+            }
+        }
+    }
+}
+
+// Outer variables that no nested function assigns are passed as arguments, up to MAX_CAPTURE
+static void chooseCaptured(escFun fun) {
+    int n = 0;
+    for (escVarList refs = fun->refs; refs && n < MAX_CAPTURE; refs = refs->tail) {
+        if (!refs->head->u.escape.no_capture) {
+            fun->captured = EscVarList(refs->name, refs->head, fun->captured);
+            n++;
+        }
+    }
+}
+
+/*
+ * A function needs its static link to reach outer variables it does not capture,
+ * to compute the static link of a callee declared further out, and to let its
+ * children walk through its frame. Reaches only grow, so this terminates.
+ */
+static void propagateReach() {
+    bool changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (escFunList funs = all_funs; funs; funs = funs->tail) {
+            escFun f = funs->head;
+            if (!f->live) {
+                continue;
+            }
+            int reach = f->level;
+            for (escFunList callees = f->callees; callees; callees = callees->tail) {
+                escFun g = callees->head;
+                if (needsLink(g) && g->parent->level < reach) {
+                    reach = g->parent->level;
+                }
+            }
+            for (escFunList children = f->children; children; children = children->tail) {
+                if (children->head->live && children->head->reach < reach) {
+                    reach = children->head->reach;
+                }
+            }
+            for (escVarList refs = f->refs; refs; refs = refs->tail) {
+                if (!inVarList(f->captured, refs->head) && refs->head->u.escape.level < reach) {
+                    reach = refs->head->u.escape.level;
+                }
+            }
+
+            if (reach < f->reach) {
+                f->reach = reach;
+                changed = TRUE;
+            }
+        }
+    }
+}
+
+static void reportFun(FILE *report, escFun fun) {
+    int n_frame = 0, n_reg = 0, n_captured = 0;
+    for (escVarList vars = fun->vars; vars; vars = vars->tail) {
+        if (*(vars->head->u.escape.target)) {
+            n_frame++;
+        } else {
+            n_reg++;
+        }
+    }
+    for (escVarList captured = fun->captured; captured; captured = captured->tail) {
+        n_captured++;
+    }
+
+    fprintf(report, "escape: %s: %d in frame, %d in registers", fun->fundec ? S_name(fun->fundec->name) : "main",
+            n_frame, n_reg);
+    if (!fun->fundec) {
+        fprintf(report, "\n");
+    } else if (!fun->live) {
+        fprintf(report, ", never called\n");
+    } else {
+        fprintf(report, ", %d captured%s\n", n_captured, fun->fundec->static_link ? "" : ", no static link");
+    }
+}
+
+void Esc_findEscape(A_exp exp, FILE *report) {
+    all_funs = all_funs_tail = NULL;
+    fun_map = TAB_empty();
+    escFun main = EscFun(NULL, NULL);
+    visitExp(E_base_eenv(), main, exp);
+
+    markLive(main);
+    propagateRefs();
+    for (escFunList funs = all_funs; funs; funs = funs->tail) {
+        if (funs->head->live) {
+            chooseCaptured(funs->head);
+        }
+    }
+    propagateReach();
+
+    for (escFunList funs = all_funs; funs; funs = funs->tail) {
+        escFun f = funs->head;
+        A_fundec fundec = f->fundec;
+        fundec->used = f->live;
+        fundec->static_link = !f->live || needsLink(f);
+        fundec->captured = NULL;
+        if (!f->live) {
+            continue;
+        }
+        for (escVarList refs = f->refs; refs; refs = refs->tail) {
+            if (inVarList(f->captured, refs->head)) {
+                fundec->captured = A_SymbolList(refs->name, fundec->captured);
+            } else {
+                *(refs->head->u.escape.target) = TRUE;
+            }
+        }
+    }
+
+    if (report) {
+        reportFun(report, main);
+        for (escFunList funs = all_funs; funs; funs = funs->tail) {
+            reportFun(report, funs->head);
+        }
+    }
+}
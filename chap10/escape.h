@@ -5,8 +5,14 @@
 #ifndef TIGER_ESCAPE
 #define TIGER_ESCAPE
 
+#include <stdio.h>
 #include "absyn.h"
 
-void Esc_findEscape(A_exp exp);
+/*
+ * Set the escape fields of variables, and the static link needs of functions.
+ * If report is not NULL, the number of variables each function keeps in its
+ * frame and in registers is reported to it.
+ */
+void Esc_findEscape(A_exp exp, FILE *report);
 
 #endif //TIGER_ESCAPE
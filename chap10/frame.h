@@ -22,18 +22,51 @@ struct F_frame_ {
     Temp_label name;
     int n_frame_local;
     F_accessList formals;
+    F_accessList pointers;  // Formals and locals in the frame that hold heap pointers
 };
 
 extern const int F_wordSize;
 extern const int F_maxRegArg;
 
-F_frame F_newFrame(Temp_label name, U_boolList formals);
+/* formals tells which formals escape, pointers which are heap pointers (NULL if none) */
+F_frame F_newFrame(Temp_label name, U_boolList formals, U_boolList pointers);
 
 Temp_label F_name(F_frame frame);
 
 F_accessList F_formals(F_frame frame);
 
-F_access F_allocLocal(F_frame f, bool escape);
+F_access F_allocLocal(F_frame f, bool escape, bool pointer);
+
+bool F_isPointer(F_access access);
+
+// Offset of a variable in the frame from the frame pointer
+int F_offset(F_access access);
+
+/*
+ * Store nil in the frame slots of the pointer locals, so that a collector reading
+ * them at a call before their declarations has run finds no stale words; NULL if
+ * there are none
+ */
+T_stm F_clearPointers(F_frame frame);
+
+bool F_frameFits(F_frame caller, F_frame callee);
+
+/*
+ * How a function reaches the frames of enclosing functions: by a chain of static
+ * links, or through a global display holding, for each nesting depth, the frame
+ * pointer of the innermost active function at that depth.
+ */
+typedef enum {
+    F_staticLinks, F_display
+} F_linkMode;
+
+extern const F_linkMode F_link;
+
+// Display slot of the given nesting depth (only with F_display)
+T_exp F_displayEntry(int depth);
+
+// Whether nested functions may read variables of the frame
+bool F_hasEscaping(F_frame frame);
 
 Temp_temp F_FP();
 
@@ -0,0 +1,505 @@
+/*
+ * inline.c - inline expansion of small functions
+ *
+ * Works on the IR trees produced by translate, before canonicalization.
+ * A call CALL(NAME f, sl :: args) is replaced by
+ *
+ *   ESEQ(MOVE(TEMP sl', sl); MOVE(TEMP p1', a1); ...; body')
+ *
+ * where body' is a copy of f's body with fresh temps and labels, and each
+ * static link load MEM(FP + SL_OFFSET) rewritten to TEMP sl'. Only functions
+ * that touch their own frame through the static link alone can be expanded,
+ * so the inlined body never needs the frame of the callee.
+ */
+
+#include "inline.h"
+#include "translate.h"
+#include "table.h"
+
+typedef struct funInfo_ *funInfo;
+struct funInfo_ {
+    F_frag frag;
+    int n_call;     // Number of call sites referring to this function
+    bool inlined;   // At least one call site has been expanded
+};
+
+static S_table fun_env; // Map function label to funInfo
+static Temp_map machine_regs;
+
+static funInfo FunInfo(F_frag frag) {
+    funInfo p = checked_malloc(sizeof(*p));
+    p->frag = frag;
+    p->n_call = 0;
+    p->inlined = FALSE;
+    return p;
+}
+
+static funInfo lookCallee(T_exp exp) {
+    if (exp->kind != T_CALL || exp->u.CALL.fun->kind != T_NAME) {
+        return NULL;
+    }
+    return S_look(fun_env, exp->u.CALL.fun->u.NAME);
+}
+
+static T_exp procBody(F_frag frag) {
+    T_stm body = frag->u.proc.body;
+    assert(body->kind == T_MOVE && body->u.MOVE.dst->kind == T_TEMP && body->u.MOVE.dst->u.TEMP == F_RV());
+    return body->u.MOVE.src;
+}
+
+// MEM(BINOP(PLUS, TEMP FP, CONST SL_OFFSET))
+static bool isSlLoad(T_exp exp) {
+    return exp->kind == T_MEM && exp->u.MEM->kind == T_BINOP && exp->u.MEM->u.BINOP.op == T_plus
+           && exp->u.MEM->u.BINOP.left->kind == T_TEMP && exp->u.MEM->u.BINOP.left->u.TEMP == F_FP()
+           && exp->u.MEM->u.BINOP.right->kind == T_CONST && exp->u.MEM->u.BINOP.right->u.CONST == SL_OFFSET;
+}
+
+/*
+ * Tree walking helpers
+ */
+
+static int sizeExp(T_exp exp);
+
+static int sizeStm(T_stm stm) {
+    switch (stm->kind) {
+        case T_SEQ:
+            return sizeStm(stm->u.SEQ.left) + sizeStm(stm->u.SEQ.right);
+        case T_LABEL:
+            return 1;
+        case T_JUMP:
+            return 1 + sizeExp(stm->u.JUMP.exp);
+        case T_CJUMP:
+            return 1 + sizeExp(stm->u.CJUMP.left) + sizeExp(stm->u.CJUMP.right);
+        case T_MOVE:
+            return 1 + sizeExp(stm->u.MOVE.dst) + sizeExp(stm->u.MOVE.src);
+        case T_EXP:
+            return sizeExp(stm->u.EXP);
+        default:
+            assert(0);
+    }
+}
+
+static int sizeExp(T_exp exp) {
+    switch (exp->kind) {
+        case T_BINOP:
+            return 1 + sizeExp(exp->u.BINOP.left) + sizeExp(exp->u.BINOP.right);
+        case T_MEM:
+            return 1 + sizeExp(exp->u.MEM);
+        case T_ESEQ:
+            return sizeStm(exp->u.ESEQ.stm) + sizeExp(exp->u.ESEQ.exp);
+        case T_CALL: {
+            int size = 1;
+            for (T_expList args = exp->u.CALL.args; args; args = args->tail) {
+                size += sizeExp(args->head);
+            }
+            return size;
+        }
+        default:
+            return 1;
+    }
+}
+
+static void countCallsExp(T_exp exp, int delta);
+
+static void countCallsStm(T_stm stm, int delta) {
+    switch (stm->kind) {
+        case T_SEQ:
+            countCallsStm(stm->u.SEQ.left, delta);
+            countCallsStm(stm->u.SEQ.right, delta);
+            break;
+        case T_JUMP:
+            countCallsExp(stm->u.JUMP.exp, delta);
+            break;
+        case T_CJUMP:
+            countCallsExp(stm->u.CJUMP.left, delta);
+            countCallsExp(stm->u.CJUMP.right, delta);
+            break;
+        case T_MOVE:
+            countCallsExp(stm->u.MOVE.dst, delta);
+            countCallsExp(stm->u.MOVE.src, delta);
+            break;
+        case T_EXP:
+            countCallsExp(stm->u.EXP, delta);
+            break;
+        default:;
+    }
+}
+
+static void countCallsExp(T_exp exp, int delta) {
+    switch (exp->kind) {
+        case T_BINOP:
+            countCallsExp(exp->u.BINOP.left, delta);
+            countCallsExp(exp->u.BINOP.right, delta);
+            break;
+        case T_MEM:
+            countCallsExp(exp->u.MEM, delta);
+            break;
+        case T_ESEQ:
+            countCallsStm(exp->u.ESEQ.stm, delta);
+            countCallsExp(exp->u.ESEQ.exp, delta);
+            break;
+        case T_CALL: {
+            funInfo callee = lookCallee(exp);
+            if (callee) {
+                callee->n_call += delta;
+            }
+            for (T_expList args = exp->u.CALL.args; args; args = args->tail) {
+                countCallsExp(args->head, delta);
+            }
+            break;
+        }
+        default:;
+    }
+}
+
+/*
+ * A body can be expanded elsewhere only if it does not call itself, and uses
+ * the frame pointer for nothing but loading its static link.
+ */
+
+static bool canInlineExp(T_exp exp, Temp_label self, bool *uses_sl);
+
+static bool canInlineStm(T_stm stm, Temp_label self, bool *uses_sl) {
+    switch (stm->kind) {
+        case T_SEQ:
+            return canInlineStm(stm->u.SEQ.left, self, uses_sl) && canInlineStm(stm->u.SEQ.right, self, uses_sl);
+        case T_JUMP:
+            return canInlineExp(stm->u.JUMP.exp, self, uses_sl);
+        case T_CJUMP:
+            return canInlineExp(stm->u.CJUMP.left, self, uses_sl) && canInlineExp(stm->u.CJUMP.right, self, uses_sl);
+        case T_MOVE:
+            return canInlineExp(stm->u.MOVE.dst, self, uses_sl) && canInlineExp(stm->u.MOVE.src, self, uses_sl);
+        case T_EXP:
+            return canInlineExp(stm->u.EXP, self, uses_sl);
+        default:
+            return TRUE;
+    }
+}
+
+static bool canInlineExp(T_exp exp, Temp_label self, bool *uses_sl) {
+    if (isSlLoad(exp)) {
+        *uses_sl = TRUE;
+        return TRUE;
+    }
+
+    switch (exp->kind) {
+        case T_BINOP:
+            return canInlineExp(exp->u.BINOP.left, self, uses_sl) && canInlineExp(exp->u.BINOP.right, self, uses_sl);
+        case T_MEM:
+            return canInlineExp(exp->u.MEM, self, uses_sl);
+        case T_ESEQ:
+            return canInlineStm(exp->u.ESEQ.stm, self, uses_sl) && canInlineExp(exp->u.ESEQ.exp, self, uses_sl);
+        case T_TEMP:
+            return exp->u.TEMP != F_FP();
+        case T_CALL:
+            if (exp->u.CALL.fun->kind == T_NAME && exp->u.CALL.fun->u.NAME == self) {
+                return FALSE;
+            }
+            for (T_expList args = exp->u.CALL.args; args; args = args->tail) {
+                if (!canInlineExp(args->head, self, uses_sl)) {
+                    return FALSE;
+                }
+            }
+            return canInlineExp(exp->u.CALL.fun, self, uses_sl);
+        default:
+            return TRUE;
+    }
+}
+
+/*
+ * Copy a body, giving each copy its own temps and labels
+ */
+
+static TAB_table temp_map;  // Map callee temp to caller temp
+static S_table label_map;   // Map callee label to caller label
+static Temp_temp sl_temp;
+
+static Temp_temp copyTemp(Temp_temp temp) {
+    if (Temp_look(machine_regs, temp)) {
+        return temp;
+    }
+    Temp_temp t = TAB_look(temp_map, temp);
+    if (!t) {
+        t = Temp_newtemp();
+        t->pointer = temp->pointer;
+        TAB_enter(temp_map, temp, t);
+    }
+    return t;
+}
+
+static Temp_label copyLabel(Temp_label label) {
+    Temp_label l = S_look(label_map, label);
+    if (!l) {
+        l = Temp_newlabel();
+        S_enter(label_map, label, l);
+    }
+    return l;
+}
+
+static T_exp copyExp(T_exp exp);
+
+static T_stm copyStm(T_stm stm) {
+    switch (stm->kind) {
+        case T_SEQ:
+            return T_Seq(copyStm(stm->u.SEQ.left), copyStm(stm->u.SEQ.right));
+        case T_LABEL:
+            return T_Label(copyLabel(stm->u.LABEL));
+        case T_JUMP: {
+            Temp_labelList jumps = NULL, tail = NULL;
+            for (Temp_labelList l = stm->u.JUMP.jumps; l; l = l->tail) {
+                Temp_labelList node = Temp_LabelList(copyLabel(l->head), NULL);
+                if (!jumps) {
+                    jumps = tail = node;
+                } else {
+                    tail->tail = node;
+                    tail = node;
+                }
+            }
+            T_exp target = stm->u.JUMP.exp->kind == T_NAME ? T_Name(copyLabel(stm->u.JUMP.exp->u.NAME))
+                                                            : copyExp(stm->u.JUMP.exp);
+            return T_Jump(target, jumps);
+        }
+        case T_CJUMP:
+            return T_Cjump(stm->u.CJUMP.op, copyExp(stm->u.CJUMP.left), copyExp(stm->u.CJUMP.right),
+                           copyLabel(stm->u.CJUMP.true), copyLabel(stm->u.CJUMP.false));
+        case T_MOVE:
+            return T_Move(copyExp(stm->u.MOVE.dst), copyExp(stm->u.MOVE.src));
+        case T_EXP:
+            return T_Exp(copyExp(stm->u.EXP));
+        default:
+            assert(0);
+    }
+}
+
+static T_exp copyNode(T_exp exp) {
+    if (isSlLoad(exp)) {
+        return T_Temp(sl_temp);
+    }
+
+    switch (exp->kind) {
+        case T_BINOP:
+            return T_Binop(exp->u.BINOP.op, copyExp(exp->u.BINOP.left), copyExp(exp->u.BINOP.right));
+        case T_MEM:
+            return T_Mem(copyExp(exp->u.MEM));
+        case T_TEMP:
+            return T_Temp(copyTemp(exp->u.TEMP));
+        case T_ESEQ:
+            return T_Eseq(copyStm(exp->u.ESEQ.stm), copyExp(exp->u.ESEQ.exp));
+        case T_NAME:
+            return T_Name(exp->u.NAME);
+        case T_CONST:
+            return T_Const(exp->u.CONST);
+        case T_CALL: {
+            T_expList args = NULL, tail = NULL;
+            for (T_expList l = exp->u.CALL.args; l; l = l->tail) {
+                T_expList node = T_ExpList(copyExp(l->head), NULL);
+                if (!args) {
+                    args = tail = node;
+                } else {
+                    tail->tail = node;
+                    tail = node;
+                }
+            }
+            return T_Call(copyExp(exp->u.CALL.fun), args);
+        }
+        default:
+            assert(0);
+    }
+}
+
+static T_exp copyExp(T_exp exp) {
+    T_exp copy = copyNode(exp);
+    copy->pointer = exp->pointer;
+    return copy;
+}
+
+/*
+ * Expansion
+ */
+
+static int budget;
+static FILE *report;
+static F_frame caller;
+
+/*
+ * The static link is the only formal always kept in the frame; a function lifted by
+ * escape analysis has none. Mistaking an escaping formal of a lifted function for a
+ * static link is harmless, since its body then reads the frame and is not inlined.
+ */
+static bool hasStaticLink(F_frame frame) {
+    F_accessList formals = F_formals(frame);
+    return formals && F_exp(formals->head, T_Temp(F_FP()))->kind != T_TEMP;
+}
+
+// Formals (except the static link) must live in temps, since the callee frame is gone.
+// For the same reason the callee must not have locals in its frame.
+static bool formalsInReg(F_frame frame) {
+    F_accessList formals = F_formals(frame);
+    for (formals = hasStaticLink(frame) ? formals->tail : formals; formals; formals = formals->tail) {
+        if (F_exp(formals->head, T_Temp(F_FP()))->kind != T_TEMP) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static T_exp expandCall(T_exp call, funInfo callee) {
+    F_frame frame = callee->frag->u.proc.frame;
+    T_exp body = procBody(callee->frag);
+    bool uses_sl = FALSE;
+
+    if (frame == caller || frame->n_frame_local || !formalsInReg(frame)
+        || !canInlineExp(body, F_name(frame), &uses_sl)) {
+        return call;
+    }
+
+    int size = sizeExp(body);
+    if (size > budget && callee->n_call != 1) {
+        return call;
+    }
+
+    temp_map = TAB_empty();
+    label_map = S_empty();
+    sl_temp = Temp_newtemp();
+
+    // Bind the actual arguments to fresh copies of the formals, in evaluation order
+    T_stm bind = NULL;
+    T_expList args = call->u.CALL.args;
+    F_accessList formals = F_formals(frame);
+    if (hasStaticLink(frame)) {
+        if (uses_sl) {
+            bind = T_Move(T_Temp(sl_temp), args->head);
+        }
+        args = args->tail;
+        formals = formals->tail;
+    }
+    for (; formals; formals = formals->tail) {
+        assert(args);
+        T_stm move = T_Move(T_Temp(copyTemp(F_exp(formals->head, T_Temp(F_FP()))->u.TEMP)), args->head);
+        bind = bind ? T_Seq(bind, move) : move;
+        args = args->tail;
+    }
+    assert(!args);
+
+    T_exp copy = copyExp(body);
+    callee->n_call--;
+    countCallsExp(copy, 1);
+    callee->inlined = TRUE;
+
+    if (report) {
+        fprintf(report, "inline: %s into %s (size %d%s)\n", Tr_functionName(F_name(frame)),
+                Tr_functionName(F_name(caller)), size, size > budget ? ", single call site" : "");
+    }
+
+    return bind ? T_Eseq(bind, copy) : copy;
+}
+
+static T_exp inlineExp(T_exp exp);
+
+static void inlineStm(T_stm stm) {
+    switch (stm->kind) {
+        case T_SEQ:
+            inlineStm(stm->u.SEQ.left);
+            inlineStm(stm->u.SEQ.right);
+            break;
+        case T_JUMP:
+            stm->u.JUMP.exp = inlineExp(stm->u.JUMP.exp);
+            break;
+        case T_CJUMP:
+            stm->u.CJUMP.left = inlineExp(stm->u.CJUMP.left);
+            stm->u.CJUMP.right = inlineExp(stm->u.CJUMP.right);
+            break;
+        case T_MOVE:
+            stm->u.MOVE.dst = inlineExp(stm->u.MOVE.dst);
+            stm->u.MOVE.src = inlineExp(stm->u.MOVE.src);
+            break;
+        case T_EXP:
+            stm->u.EXP = inlineExp(stm->u.EXP);
+            break;
+        default:;
+    }
+}
+
+static T_exp inlineExp(T_exp exp) {
+    switch (exp->kind) {
+        case T_BINOP:
+            exp->u.BINOP.left = inlineExp(exp->u.BINOP.left);
+            exp->u.BINOP.right = inlineExp(exp->u.BINOP.right);
+            return exp;
+        case T_MEM:
+            exp->u.MEM = inlineExp(exp->u.MEM);
+            return exp;
+        case T_ESEQ:
+            inlineStm(exp->u.ESEQ.stm);
+            exp->u.ESEQ.exp = inlineExp(exp->u.ESEQ.exp);
+            return exp;
+        case T_CALL: {
+            for (T_expList args = exp->u.CALL.args; args; args = args->tail) {
+                args->head = inlineExp(args->head);
+            }
+            funInfo callee = lookCallee(exp);
+            return callee ? expandCall(exp, callee) : exp;
+        }
+        default:
+            return exp;
+    }
+}
+
+F_fragList Inl_inline(F_fragList frags, int budget_, FILE *report_) {
+    if (budget_ <= 0) {
+        return frags;
+    }
+    budget = budget_;
+    report = report_;
+    machine_regs = F_TempMap();
+    fun_env = S_empty();
+
+    for (F_fragList p = frags; p; p = p->tail) {
+        if (p->head->kind == F_procFrag && F_name(p->head->u.proc.frame) != Temp_namedlabel("main")) {
+            S_enter(fun_env, F_name(p->head->u.proc.frame), FunInfo(p->head));
+        }
+    }
+    for (F_fragList p = frags; p; p = p->tail) {
+        if (p->head->kind == F_procFrag) {
+            countCallsStm(p->head->u.proc.body, 1);
+        }
+    }
+
+    // Fragments are ordered inner functions first, so callees are mostly expanded before their callers
+    for (F_fragList p = frags; p; p = p->tail) {
+        if (p->head->kind == F_procFrag) {
+            caller = p->head->u.proc.frame;
+            inlineStm(p->head->u.proc.body);
+        }
+    }
+
+    // Drop the functions that are no longer called, until nothing changes
+    bool changed;
+    do {
+        changed = FALSE;
+        F_fragList res = NULL, tail = NULL;
+        for (F_fragList p = frags; p; p = p->tail) {
+            if (p->head->kind == F_procFrag) {
+                funInfo info = S_look(fun_env, F_name(p->head->u.proc.frame));
+                if (info && info->inlined && info->n_call == 0) {
+                    countCallsStm(p->head->u.proc.body, -1);
+                    info->inlined = FALSE;
+                    changed = TRUE;
+                    if (report) {
+                        fprintf(report, "inline: removed %s\n", Tr_functionName(F_name(p->head->u.proc.frame)));
+                    }
+                    continue;
+                }
+            }
+            if (!res) {
+                res = tail = F_FragList(p->head, NULL);
+            } else {
+                tail->tail = F_FragList(p->head, NULL);
+                tail = tail->tail;
+            }
+        }
+        frags = res;
+    } while (changed);
+
+    return frags;
+}
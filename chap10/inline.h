@@ -0,0 +1,24 @@
+/*
+ * inline.h - inline expansion of small functions
+ */
+
+#ifndef TIGER_INLINE
+#define TIGER_INLINE
+
+#include <stdio.h>
+#include "frame.h"
+
+// Default size budget (in IR nodes) of a function body that may be inlined
+#define INL_DEFAULT_BUDGET 24
+
+/*
+ * Expand calls to small non-recursive functions, and to functions with only
+ * one call site, into their callers. Functions whose every call site has been
+ * expanded are removed from the fragment list.
+ *
+ * A budget of 0 disables inlining. If report is not NULL, every expanded call
+ * is reported to it.
+ */
+F_fragList Inl_inline(F_fragList frags, int budget, FILE *report);
+
+#endif //TIGER_INLINE
@@ -291,7 +291,8 @@ LV_graph LV_liveness(G_graph flow) {
 
     LV_graph g = {
             .graph = graph,
-            .moves = list
+            .moves = list,
+            .out = out
     };
 
     return g;
@@ -15,6 +15,7 @@ typedef struct LV_graph_ LV_graph;
 struct LV_graph_ {
     G_graph graph;
     LV_moveList moves;
+    G_table out;    // Temps live out of each node of the flow graph, as a Temp_tempList
 };
 
 Temp_temp LV_gtemp(G_node n);
@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "util.h"
 #include "symbol.h"
 #include "absyn.h"
@@ -16,9 +19,22 @@
 #include "translate.h"
 #include "flowgraph.h"
 #include "liveness.h"
+#include "inline.h"
+#include "peephole.h"
+#include "schedule.h"
+#include "stackmap.h"
 
 extern bool anyErrors;
 
+static bool schedule = TRUE;
+static bool stack_maps = TRUE;
+static bool greedy_layout = FALSE;
+static double taken_branches;
+
+// Time spent in instruction selection and in printing, for -time-codegen
+static clock_t select_time, print_time;
+static int instr_count;
+
 /* print the assembly language instructions to filename.s */
 static void doProc(FILE *out, F_frame frame, T_stm body) {
     AS_proc proc;
@@ -27,16 +43,32 @@ static void doProc(FILE *out, F_frame frame, T_stm body) {
     AS_instrList iList;
 
     stmList = C_linearize(body);
-    stmList = C_traceSchedule(C_basicBlocks(stmList));
+    stmList = greedy_layout ? C_traceSchedule(C_basicBlocks(stmList)) : C_layoutSchedule(C_basicBlocks(stmList));
+    taken_branches += C_takenBranches(stmList);
     printStmList(stdout, stmList);
+    clock_t start = clock();
     iList = F_codegen(frame, stmList); /* 9 */
+    select_time += clock() - start;
 
+    iList = PH_peephole(iList); /* after register allocation, once there is one */
+    G_graph flow = FG_AssemFlowGraph(iList);
+    LV_graph live = LV_liveness(flow);
+    SM_map map = stack_maps ? SM_stackMap(frame, flow, live) : NULL;
+    if (schedule)
+        iList = SC_schedule(iList);
+    if (map)
+        iList = SM_placeLabels(map, iList, schedule);
+
+    start = clock();
     fprintf(out, "BEGIN %s\n", Temp_labelstring(F_name(frame)));
     AS_printInstrList(out, iList,
                       Temp_layerMap(F_TempMap(), Temp_name()));
     fprintf(out, "END %s\n\n", Temp_labelstring(F_name(frame)));
-
-    LV_liveness(FG_AssemFlowGraph(iList));
+    if (map)
+        SM_print(out, map, Temp_layerMap(F_TempMap(), Temp_name()));
+    print_time += clock() - start;
+    for (AS_instrList l = iList; l; l = l->tail)
+        instr_count++;
 }
 
 extern A_exp absyn_root;
@@ -48,9 +80,58 @@ int main(int argc, string *argv) {
     F_fragList frags;
     char outfile[100];
     FILE *out = stdout;
+    string filename = NULL;
+    int inline_budget = INL_DEFAULT_BUDGET;
+    bool inline_report = FALSE;
+    bool escape_report = FALSE;
+    bool time_codegen = FALSE;
+    bool peephole_report = FALSE;
+    bool schedule_report = FALSE;
+    bool layout_report = FALSE;
+    bool stackmap_report = FALSE;
 
-    if (argc == 2) {
-        EM_reset(argv[1]);
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "-inline=", 8)) {
+            inline_budget = atoi(argv[i] + 8);
+        } else if (!strcmp(argv[i], "-inline-report")) {
+            inline_report = TRUE;
+        } else if (!strcmp(argv[i], "-escape-report")) {
+            escape_report = TRUE;
+        } else if (!strcmp(argv[i], "-time-codegen")) {
+            time_codegen = TRUE;
+        } else if (!strcmp(argv[i], "-no-peephole")) {
+            PH_enable(NULL, FALSE);
+        } else if (!strncmp(argv[i], "-no-peephole=", 13)) {
+            if (!PH_enable(argv[i] + 13, FALSE)) {
+                filename = NULL;
+                break;
+            }
+        } else if (!strcmp(argv[i], "-peephole-report")) {
+            peephole_report = TRUE;
+        } else if (!strcmp(argv[i], "-no-schedule")) {
+            schedule = FALSE;
+        } else if (!strcmp(argv[i], "-schedule-report")) {
+            schedule_report = TRUE;
+        } else if (!strcmp(argv[i], "-layout=greedy")) {
+            greedy_layout = TRUE;
+        } else if (!strcmp(argv[i], "-layout-report")) {
+            layout_report = TRUE;
+        } else if (!strcmp(argv[i], "-no-stackmaps")) {
+            stack_maps = FALSE;
+        } else if (!strcmp(argv[i], "-stackmap-report")) {
+            stackmap_report = TRUE;
+        } else if (!strcmp(argv[i], "-profile")) {
+            Tr_profileAllocations(TRUE);
+        } else if (!filename) {
+            filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+
+    if (filename) {
+        EM_reset(filename);
         yyparse();
 
         if (!absyn_root)
@@ -61,15 +142,19 @@ int main(int argc, string *argv) {
         fprintf(out, "\n");
 #endif
 
-        Esc_findEscape(absyn_root); /* set varDec's escape field */
+        Esc_findEscape(absyn_root, escape_report ? stderr : NULL); /* set varDec's escape field */
 
         SEM_transProg(absyn_root);
         frags = Tr_getResult();
         //if (anyErrors) return 1; /* don't continue */
 
+        frags = Inl_inline(frags, inline_budget, inline_report ? stderr : NULL);
+
         /* convert the filename */
-        sprintf(outfile, "%s.s", argv[1]);
+        sprintf(outfile, "%s.s", filename);
         out = fopen(outfile, "w");
+        if (schedule)
+            fprintf(out, ".set noreorder\n\n"); /* delay slots are filled by SC_schedule */
         /* Chapter 8, 9, 10, 11 & 12 */
         for (; frags; frags = frags->tail)
             if (frags->head->kind == F_procFrag)
@@ -78,8 +163,21 @@ int main(int argc, string *argv) {
                 fprintf(out, "%s\n", frags->head->u.stringg.str);
 
         fclose(out);
+        if (peephole_report)
+            PH_report(stderr);
+        if (schedule_report)
+            SC_report(stderr);
+        if (layout_report)
+            fprintf(stderr, "layout: %.1f taken branches (static estimate)\n", taken_branches);
+        if (stackmap_report)
+            SM_report(stderr);
+        if (time_codegen)
+            fprintf(stderr, "codegen: %d instructions, select %.3fs, print %.3fs\n", instr_count,
+                    (double) select_time / CLOCKS_PER_SEC, (double) print_time / CLOCKS_PER_SEC);
         return 0;
     }
-    EM_error(0, "usage: tiger file.tig");
+    EM_error(0, "usage: tiger [-inline=budget] [-inline-report] [-escape-report] [-time-codegen] [-no-peephole[=rule]] [-peephole-report]\n"
+             "       [-no-schedule] [-schedule-report] [-layout=greedy] [-layout-report] [-no-stackmaps] [-stackmap-report]\n"
+             "       [-profile] file.tig");
     return 1;
 }
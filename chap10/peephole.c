@@ -0,0 +1,238 @@
+#include <string.h>
+#include "peephole.h"
+#include "frame.h"
+#include "table.h"
+
+/*
+ * Peephole optimizer
+ *
+ * A rule looks at a window of instructions starting at a position in the list,
+ * and rewrites it in place if it matches. After a rewrite the window steps
+ * back one instruction, so that the result can match again with what precedes it.
+ *
+ * Rules that drop a temp must know it has no other use, so the uses and
+ * definitions of every temp are counted beforehand, and kept up to date.
+ */
+
+typedef struct {
+    int uses, defs;
+} *count;
+
+static TAB_table counts;
+
+static count countOf(Temp_temp t) {
+    count c = TAB_look(counts, t);
+    if (!c) {
+        c = checked_malloc(sizeof(*c));
+        c->uses = c->defs = 0;
+        TAB_enter(counts, t, c);
+    }
+    return c;
+}
+
+static Temp_tempList *dstOf(AS_instr i) {
+    return i->kind == I_MOVE ? &i->u.MOVE.dst : &i->u.OPER.dst;
+}
+
+static Temp_tempList *srcOf(AS_instr i) {
+    return i->kind == I_MOVE ? &i->u.MOVE.src : &i->u.OPER.src;
+}
+
+static void countTemps(AS_instrList il) {
+    counts = TAB_empty();
+    for (; il; il = il->tail) {
+        if (il->head->kind == I_LABEL) {
+            continue;
+        }
+        for (Temp_tempList l = *dstOf(il->head); l; l = l->tail) {
+            countOf(l->head)->defs++;
+        }
+        for (Temp_tempList l = *srcOf(il->head); l; l = l->tail) {
+            countOf(l->head)->uses++;
+        }
+    }
+}
+
+// A virtual register defined once and used once, that can be dropped with its use
+static bool isSingleUse(Temp_temp t) {
+    count c = countOf(t);
+    return !Temp_look(F_TempMap(), t) && c->uses == 1 && c->defs == 1;
+}
+
+// Whether i is "add d, s, $zero", and if so, its d and s
+static bool isMove(AS_instr i, Temp_temp *d, Temp_temp *s) {
+    if (i->kind == I_LABEL || i->op != AS_ADD) {
+        return FALSE;
+    }
+    Temp_tempList dst = *dstOf(i), src = *srcOf(i);
+    if (!dst || dst->tail || !src || !src->tail || src->tail->head != F_ZERO()) {
+        return FALSE;
+    }
+    *d = dst->head;
+    *s = src->head;
+    return TRUE;
+}
+
+// Whether i is "addi t, $zero, k"
+static bool isConst(AS_instr i) {
+    return i->kind == I_OPER && i->op == AS_ADDI && i->u.OPER.src->head == F_ZERO();
+}
+
+/*
+ * Rules
+ */
+
+// add d, d, $zero  =>
+static bool selfMove(AS_instrList *pos) {
+    Temp_temp d, s;
+    if (!isMove((*pos)->head, &d, &s) || d != s) {
+        return FALSE;
+    }
+    countOf(d)->uses--;
+    countOf(d)->defs--;
+    *pos = (*pos)->tail;
+    return TRUE;
+}
+
+// j L; L:  =>  L:
+static bool jumpToNext(AS_instrList *pos) {
+    AS_instr j = (*pos)->head, l = (*pos)->tail->head;
+    // A tail call has no targets, and leaves the function
+    if (j->kind != I_OPER || j->op != AS_J || !j->u.OPER.jumps || !j->u.OPER.jumps->labels
+        || l->kind != I_LABEL || l->u.LABEL.label != j->label) {
+        return FALSE;
+    }
+    *pos = (*pos)->tail;
+    return TRUE;
+}
+
+// sw a, k(b); lw d, k(b)  =>  sw a, k(b); add d, a, $zero
+static bool storeLoad(AS_instrList *pos) {
+    AS_instr sw = (*pos)->head, lw = (*pos)->tail->head;
+    if (sw->kind != I_OPER || sw->op != AS_SW || lw->kind != I_OPER || lw->op != AS_LW
+        || sw->imm != lw->imm || sw->u.OPER.src->tail->head != lw->u.OPER.src->head) {
+        return FALSE;
+    }
+    Temp_temp a = sw->u.OPER.src->head;
+    countOf(a)->uses++;
+    countOf(lw->u.OPER.src->head)->uses--;
+    (*pos)->tail->head = AS_Move(AS_ADD, lw->u.OPER.dst, Temp_TempList(a, Temp_TempList(F_ZERO(), NULL)));
+    return TRUE;
+}
+
+// addi t, $zero, k; add d, x, t  =>  addi d, x, k  (also sub d, x, t  =>  addi d, x, -k)
+static bool constOperand(AS_instrList *pos) {
+    AS_instr c = (*pos)->head, i = (*pos)->tail->head;
+    if (!isConst(c) || i->kind == I_LABEL || (i->op != AS_ADD && i->op != AS_SUB)) {
+        return FALSE;
+    }
+    Temp_temp t = c->u.OPER.dst->head;
+    Temp_tempList src = *srcOf(i);
+    if (!isSingleUse(t) || !src || !src->tail) {
+        return FALSE;
+    }
+
+    Temp_temp x;
+    int k = c->imm;
+    if (src->tail->head == t) {
+        x = src->head;
+        if (i->op == AS_SUB) {
+            if (k == -32768) {
+                return FALSE;
+            }
+            k = -k;
+        }
+    } else if (src->head == t && i->op == AS_ADD) {
+        x = src->tail->head;
+    } else {
+        return FALSE;
+    }
+
+    countOf(t)->uses = countOf(t)->defs = 0;
+    (*pos)->head = AS_OperImm(AS_ADDI, *dstOf(i), Temp_TempList(x, NULL), k);
+    (*pos)->tail = (*pos)->tail->tail;
+    return TRUE;
+}
+
+// op t, ...; add d, t, $zero  =>  op d, ...
+static bool moveChain(AS_instrList *pos) {
+    AS_instr i = (*pos)->head, m = (*pos)->tail->head;
+    Temp_temp d, t;
+    if (i->kind == I_LABEL || !isMove(m, &d, &t)) {
+        return FALSE;
+    }
+    Temp_tempList *dst = dstOf(i);
+    if (!*dst || (*dst)->tail || (*dst)->head != t || !isSingleUse(t)) {
+        return FALSE;
+    }
+    countOf(t)->uses = countOf(t)->defs = 0;
+    *dst = Temp_TempList(d, NULL);
+    (*pos)->tail = (*pos)->tail->tail;
+    return TRUE;
+}
+
+static struct {
+    string name;
+    int window;
+    bool (*apply)(AS_instrList *pos);
+    bool enabled;
+    int hits;
+} rules[] = {
+        {"self-move", 1, selfMove, TRUE, 0},
+        {"jump-to-next", 2, jumpToNext, TRUE, 0},
+        {"store-load", 2, storeLoad, TRUE, 0},
+        {"const-operand", 2, constOperand, TRUE, 0},
+        {"move-chain", 2, moveChain, TRUE, 0},
+};
+
+#define N_RULES (sizeof(rules) / sizeof(rules[0]))
+
+static bool fits(AS_instrList il, int window) {
+    for (; window > 0; window--, il = il->tail) {
+        if (!il) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+AS_instrList PH_peephole(AS_instrList il) {
+    countTemps(il);
+    AS_instrList *pos = &il, *prev = NULL;
+    while (*pos) {
+        bool hit = FALSE;
+        for (int r = 0; r < N_RULES && !hit; r++) {
+            if (rules[r].enabled && fits(*pos, rules[r].window) && rules[r].apply(pos)) {
+                rules[r].hits++;
+                hit = TRUE;
+            }
+        }
+        if (hit) {
+            if (prev) {
+                pos = prev;
+                prev = NULL;
+            }
+        } else {
+            prev = pos;
+            pos = &(*pos)->tail;
+        }
+    }
+    return il;
+}
+
+bool PH_enable(string name, bool enable) {
+    bool found = FALSE;
+    for (int r = 0; r < N_RULES; r++) {
+        if (!name || !strcmp(rules[r].name, name)) {
+            rules[r].enabled = enable;
+            found = TRUE;
+        }
+    }
+    return found;
+}
+
+void PH_report(FILE *out) {
+    for (int r = 0; r < N_RULES; r++) {
+        fprintf(out, "peephole: %-14s %d%s\n", rules[r].name, rules[r].hits, rules[r].enabled ? "" : " (disabled)");
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ * peephole.h - peephole optimization of instruction lists
+ */
+
+#ifndef TIGER_PEEPHOLE
+#define TIGER_PEEPHOLE
+
+#include <stdio.h>
+#include "assem.h"
+
+/*
+ * Rewrite il by sliding a window over it and applying the enabled rules of the
+ * pattern table, until none of them matches. Runs where register allocation
+ * would, so the temps not precolored are still virtual registers.
+ */
+AS_instrList PH_peephole(AS_instrList il);
+
+// Enable or disable the rule called name, or every rule if name is NULL. Returns FALSE for an unknown rule.
+bool PH_enable(string name, bool enable);
+
+// Report, for every rule, how many times it fired so far
+void PH_report(FILE *out);
+
+#endif //TIGER_PEEPHOLE
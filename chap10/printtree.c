@@ -20,7 +20,8 @@ static void indent(FILE *out, int d) {
 
 static char bin_oper[][12] = {
         "PLUS", "MINUS", "TIMES", "DIVIDE",
-        "AND", "OR", "LSHIFT", "RSHIFT", "ARSHIFT", "XOR"};
+        "AND", "OR", "LSHIFT", "RSHIFT", "ARSHIFT", "XOR",
+        "SLT", "SLTU"};
 
 static char rel_oper[][12] = {
         "EQ", "NE", "LT", "GT", "LE", "GE", "ULT", "ULE", "UGT", "UGE"};
@@ -123,7 +124,7 @@ static void pr_tree_exp(FILE *out, T_exp exp, int d) {
         case T_CALL: {
             T_expList args = exp->u.CALL.args;
             indent(out, d);
-            fprintf(out, "CALL(\n");
+            fprintf(out, exp->u.CALL.tail ? "TAILCALL(\n" : "CALL(\n");
             pr_tree_exp(out, exp->u.CALL.fun, d + 1);
             for (; args; args = args->tail) {
                 fprintf(out, ",\n");
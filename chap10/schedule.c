@@ -0,0 +1,278 @@
+#include "schedule.h"
+#include "frame.h"
+
+/*
+ * Instruction scheduler
+ *
+ * A basic block is a run of instructions between labels, ended by a branch,
+ * jump or call if any. Its body is list-scheduled cycle by cycle: of the
+ * instructions whose predecessors in the dependence graph are all issued, the
+ * one that can issue soonest wins, and of those the one on the longest path
+ * to the end of the block. The last issued instruction that nothing depends on
+ * then goes into the delay slot of the terminator.
+ *
+ * Calls and the hi/lo registers are not described by the operand lists,
+ * so calls end blocks, and mult/div are ordered with mfhi/mflo explicitly.
+ */
+
+// Latencies of a MIPS R3000-like pipeline; 1 if not listed
+static int latencies[AS_SINK + 1] = {
+        [AS_LW] = 2,
+        [AS_MULT] = 12,
+        [AS_DIV] = 35,
+};
+
+static int latency(AS_instr i) {
+    return latencies[i->op] ? latencies[i->op] : 1;
+}
+
+static int slots, filled, nops;
+
+static Temp_tempList dstOf(AS_instr i) {
+    return i->kind == I_MOVE ? i->u.MOVE.dst : i->u.OPER.dst;
+}
+
+static Temp_tempList srcOf(AS_instr i) {
+    return i->kind == I_MOVE ? i->u.MOVE.src : i->u.OPER.src;
+}
+
+static bool intersects(Temp_tempList a, Temp_tempList b) {
+    for (; a; a = a->tail) {
+        for (Temp_tempList l = b; l; l = l->tail) {
+            if (a->head == l->head) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static bool isMulDiv(AS_instr i) {
+    return i->op == AS_MULT || i->op == AS_DIV;
+}
+
+static bool isMoveFromHiLo(AS_instr i) {
+    return i->op == AS_MFHI || i->op == AS_MFLO;
+}
+
+static bool isTerminator(AS_instr i) {
+    switch (i->op) {
+        case AS_BEQ: case AS_BNE: case AS_BLTZ: case AS_BGEZ: case AS_BGTZ: case AS_BLEZ:
+        case AS_J: case AS_JR: case AS_JAL: case AS_JALR: case AS_SINK:
+            return i->kind == I_OPER;
+        default:
+            return FALSE;
+    }
+}
+
+/*
+ * The latency of the dependence of j on an earlier i in the same block,
+ * 0 if j must only be issued after i, or -1 if they are independent
+ */
+static int dependence(AS_instr i, AS_instr j) {
+    int d = -1;
+    if (intersects(dstOf(i), srcOf(j))) {
+        d = latency(i);
+    }
+    if (intersects(dstOf(i), dstOf(j)) && d < 1) {
+        d = 1;
+    }
+    if (intersects(srcOf(i), dstOf(j)) && d < 0) {
+        d = 0;
+    }
+    // No alias analysis: memory accesses keep their order, except two loads
+    if (i->op == AS_SW && (j->op == AS_LW || j->op == AS_SW) && d < 1) {
+        d = 1;
+    }
+    if (i->op == AS_LW && j->op == AS_SW && d < 0) {
+        d = 0;
+    }
+    if (isMulDiv(i) && (isMoveFromHiLo(j) || isMulDiv(j)) && d < latency(i)) {
+        d = isMoveFromHiLo(j) ? latency(i) : 1;
+    }
+    if (isMoveFromHiLo(i) && isMulDiv(j) && d < 0) {
+        d = 0;
+    }
+    return d;
+}
+
+/*
+ * Output list
+ */
+
+static AS_instrList sched, sched_tail;
+
+static void emit(AS_instr i) {
+    if (!sched) {
+        sched = sched_tail = AS_InstrList(i, NULL);
+    } else {
+        sched_tail->tail = AS_InstrList(i, NULL);
+        sched_tail = sched_tail->tail;
+    }
+}
+
+// The instruction in the delay slot of term must neither disturb it nor be disturbed by it
+static bool fitsDelaySlot(AS_instr i, AS_instr term) {
+    if (i->op == AS_LW || isMoveFromHiLo(i)) {
+        // Its use may be the first instruction at the target
+        return FALSE;
+    }
+    return !intersects(dstOf(i), srcOf(term)) && !intersects(dstOf(i), dstOf(term))
+           && !intersects(srcOf(i), dstOf(term));
+}
+
+static void scheduleBlock(AS_instr *body, int n, AS_instr term) {
+    // One more than needed, as the block may be empty
+    int *lat = checked_malloc((n * n + 1) * sizeof(int));
+    int *height = checked_malloc((n + 1) * sizeof(int));
+    int *preds = checked_malloc((n + 1) * sizeof(int));
+    int *ready = checked_malloc((n + 1) * sizeof(int));
+    bool *issued = checked_malloc((n + 1) * sizeof(bool));
+    bool *sink = checked_malloc((n + 1) * sizeof(bool));
+    int *order = checked_malloc((n + 1) * sizeof(int));
+
+    for (int i = 0; i < n; i++) {
+        preds[i] = 0;
+        ready[i] = 0;
+        issued[i] = FALSE;
+        sink[i] = TRUE;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            lat[i * n + j] = j > i ? dependence(body[i], body[j]) : -1;
+            if (lat[i * n + j] >= 0) {
+                preds[j]++;
+                sink[i] = FALSE;
+            }
+        }
+    }
+    // Length of the longest path from each instruction to the end of the block
+    for (int i = n - 1; i >= 0; i--) {
+        height[i] = latency(body[i]);
+        for (int j = i + 1; j < n; j++) {
+            if (lat[i * n + j] >= 0 && lat[i * n + j] + height[j] > height[i]) {
+                height[i] = lat[i * n + j] + height[j];
+            }
+        }
+    }
+
+    int cycle = 0;
+    for (int k = 0; k < n; k++) {
+        int best = -1;
+        for (int i = 0; i < n; i++) {
+            if (issued[i] || preds[i]) {
+                continue;
+            }
+            int when = ready[i] > cycle ? ready[i] : cycle, best_when = 0;
+            if (best >= 0) {
+                best_when = ready[best] > cycle ? ready[best] : cycle;
+            }
+            if (best < 0 || when < best_when || (when == best_when && height[i] > height[best])) {
+                best = i;
+            }
+        }
+        if (ready[best] > cycle) {
+            cycle = ready[best];
+        }
+        issued[best] = TRUE;
+        order[k] = best;
+        for (int j = 0; j < n; j++) {
+            if (lat[best * n + j] >= 0) {
+                preds[j]--;
+                if (cycle + lat[best * n + j] > ready[j]) {
+                    ready[j] = cycle + lat[best * n + j];
+                }
+            }
+        }
+        cycle++;
+    }
+
+    int slot = -1;
+    if (term && term->op != AS_SINK) {
+        slots++;
+        for (int k = n - 1; k >= 0 && slot < 0; k--) {
+            if (sink[order[k]] && fitsDelaySlot(body[order[k]], term)) {
+                slot = order[k];
+            }
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        if (order[k] != slot) {
+            emit(body[order[k]]);
+        }
+    }
+    if (term) {
+        emit(term);
+        if (term->op != AS_SINK) {
+            if (slot >= 0) {
+                filled++;
+                emit(body[slot]);
+            } else {
+                emit(AS_Oper(AS_NOP, NULL, NULL, NULL));
+            }
+        }
+    }
+}
+
+/*
+ * Separate the remaining hazards by nops: a load from the use of its result in
+ * the next instruction, and mfhi/mflo from a mult or div in the next two.
+ * Delay slots never hold either, so looking back in list order is enough.
+ */
+static AS_instrList fixHazards(AS_instrList il) {
+    AS_instr prev = NULL, prev2 = NULL;
+    sched = sched_tail = NULL;
+    for (; il; il = il->tail) {
+        AS_instr i = il->head;
+        if (i->kind == I_LABEL) {
+            emit(i);
+            continue;
+        }
+        while ((prev && prev->op == AS_LW && intersects(dstOf(prev), srcOf(i)))
+               || (isMulDiv(i) && ((prev && isMoveFromHiLo(prev)) || (prev2 && isMoveFromHiLo(prev2))))) {
+            emit(AS_Oper(AS_NOP, NULL, NULL, NULL));
+            nops++;
+            prev2 = prev;
+            prev = sched_tail->head;
+        }
+        emit(i);
+        if (i->op != AS_SINK) {
+            prev2 = prev;
+            prev = i;
+        }
+    }
+    return sched;
+}
+
+AS_instrList SC_schedule(AS_instrList il) {
+    int n = 0, size = 16;
+    AS_instr *body = checked_malloc(size * sizeof(AS_instr));
+
+    sched = sched_tail = NULL;
+    for (; il; il = il->tail) {
+        AS_instr i = il->head;
+        if (i->kind == I_LABEL || isTerminator(i)) {
+            scheduleBlock(body, n, i->kind == I_LABEL ? NULL : i);
+            n = 0;
+            if (i->kind == I_LABEL) {
+                emit(i);
+            }
+            continue;
+        }
+        if (n == size) {
+            AS_instr *grown = checked_malloc(2 * size * sizeof(AS_instr));
+            for (int k = 0; k < n; k++) {
+                grown[k] = body[k];
+            }
+            body = grown;
+            size *= 2;
+        }
+        body[n++] = i;
+    }
+    scheduleBlock(body, n, NULL);
+    return fixHazards(sched);
+}
+
+void SC_report(FILE *out) {
+    fprintf(out, "schedule: %d of %d delay slots filled, %d nops for hazards\n", filled, slots, nops);
+}
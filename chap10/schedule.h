@@ -0,0 +1,23 @@
+/*
+ * schedule.h - instruction scheduling and delay slot filling
+ */
+
+#ifndef TIGER_SCHEDULE
+#define TIGER_SCHEDULE
+
+#include <stdio.h>
+#include "assem.h"
+
+/*
+ * List-schedule every basic block of il by the latencies of its opcodes, move an
+ * independent instruction (or a nop) into the delay slot of each branch, jump and
+ * call, and put nops where a load or a move from hi/lo would still be too close
+ * to its use. The result is meant for ".set noreorder", so it must be the
+ * last pass over the instructions: the flow graph does not know delay slots.
+ */
+AS_instrList SC_schedule(AS_instrList il);
+
+// Report the delay slots filled and the nops inserted so far
+void SC_report(FILE *out);
+
+#endif //TIGER_SCHEDULE
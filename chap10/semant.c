@@ -41,13 +41,15 @@ static void *requireSym(int pos, S_table t, S_symbol sym, void *not_found) {
 struct visitorAttrs_ {
     Tr_level level;
     Temp_label done;
+    bool tail; // The value of the expression is the result of the function
 };
 typedef struct visitorAttrs_ visitorAttrs;
 
-static visitorAttrs VisitorAttrs(Tr_level level, Temp_label done) {
+static visitorAttrs VisitorAttrs(Tr_level level, Temp_label done, bool tail) {
     visitorAttrs p = {
             .level = level,
-            .done = done
+            .done = done,
+            .tail = tail
     };
     return p;
 }
@@ -62,6 +64,11 @@ static visitorAttrs VisitorAttrs_changeDone(visitorAttrs attrs, Temp_label done)
     return attrs;
 }
 
+static visitorAttrs VisitorAttrs_changeTail(visitorAttrs attrs, bool tail) {
+    attrs.tail = tail;
+    return attrs;
+}
+
 static expty visitExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs attrs);
 
 static expty visitVar(S_table tenv, S_table venv, A_var var, visitorAttrs attrs, bool *is_loopvar_check);
@@ -112,6 +119,16 @@ static Ty_ty actualTy(Ty_ty ty) {
     return ty;
 }
 
+// Whether values of the type are heap pointers (or nil) for the collector
+static bool isPointer(Ty_ty ty) {
+    switch (actualTy(ty)->kind) {
+        case Ty_record: case Ty_array: case Ty_string: case Ty_nil:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
 static bool isTypeCompat(Ty_ty lhs, Ty_ty rhs) {
     Ty_ty l = actualTy(lhs), r = actualTy(rhs);
 
@@ -121,40 +138,65 @@ static bool isTypeCompat(Ty_ty lhs, Ty_ty rhs) {
 }
 
 static expty visitExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs attrs) {
+    // Only calls, sequences, ifs and lets may pass the tail position down to a subexpression
+    if (exp->kind != A_callExp && exp->kind != A_seqExp && exp->kind != A_ifExp && exp->kind != A_letExp) {
+        attrs = VisitorAttrs_changeTail(attrs, FALSE);
+    }
+
+    expty result;
     switch (exp->kind) {
         case A_varExp:
-            return visitVar(tenv, venv, exp->u.var, attrs, NULL);
+            result = visitVar(tenv, venv, exp->u.var, attrs, NULL);
+            break;
         case A_nilExp:
-            return visitNilExp();
+            result = visitNilExp();
+            break;
         case A_intExp:
-            return visitIntExp(exp->u.intt);
+            result = visitIntExp(exp->u.intt);
+            break;
         case A_stringExp:
-            return visitStringExp(exp->u.stringg);
+            result = visitStringExp(exp->u.stringg);
+            break;
         case A_callExp:
-            return visitCallExp(tenv, venv, exp, attrs);
+            result = visitCallExp(tenv, venv, exp, attrs);
+            break;
         case A_opExp:
-            return visitOpExp(tenv, venv, exp, attrs);
+            result = visitOpExp(tenv, venv, exp, attrs);
+            break;
         case A_recordExp:
-            return visitRecordExp(tenv, venv, exp, attrs);
+            result = visitRecordExp(tenv, venv, exp, attrs);
+            break;
         case A_seqExp:
-            return visitSeqExp(tenv, venv, exp->u.seq, attrs);
+            result = visitSeqExp(tenv, venv, exp->u.seq, attrs);
+            break;
         case A_assignExp:
-            return visitAssignExp(tenv, venv, exp, attrs);
+            result = visitAssignExp(tenv, venv, exp, attrs);
+            break;
         case A_ifExp:
-            return visitIfExp(tenv, venv, exp, attrs);
+            result = visitIfExp(tenv, venv, exp, attrs);
+            break;
         case A_whileExp:
-            return visitWhileExp(tenv, venv, exp, attrs);
+            result = visitWhileExp(tenv, venv, exp, attrs);
+            break;
         case A_forExp:
-            return visitForExp(tenv, venv, exp, attrs);
+            result = visitForExp(tenv, venv, exp, attrs);
+            break;
         case A_breakExp:
-            return visitBreakExp(exp, attrs);
+            result = visitBreakExp(exp, attrs);
+            break;
         case A_letExp:
-            return visitLetExp(tenv, venv, exp, attrs);
+            result = visitLetExp(tenv, venv, exp, attrs);
+            break;
         case A_arrayExp:
-            return visitArrayExp(tenv, venv, exp, attrs);
+            result = visitArrayExp(tenv, venv, exp, attrs);
+            break;
         default:
             assert(0);
     }
+    if (result.exp && result.ty && isPointer(result.ty)) {
+        Tr_markPointer(result.exp);
+    }
+    return result;
 }
 
 static expty visitVar(S_table tenv, S_table venv, A_var var, visitorAttrs attrs, bool *is_loopvar_check) {
@@ -225,7 +267,7 @@ static expty visitCallExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs at
     Tr_expList arg_tr = NULL, arg_tr_tail = NULL;
 
     while (arg && formal) {
-        expty v = visitExp(tenv, venv, arg->head, attrs);
+        expty v = visitExp(tenv, venv, arg->head, VisitorAttrs_changeTail(attrs, FALSE));
 
         Ty_ty ideal = formal->head;
         Ty_ty actual = v.ty;
@@ -252,7 +294,8 @@ static expty visitCallExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs at
         return Expty(Tr_const(0), Ty_Int());
     }
 
-    return Expty(Tr_functionCall(exp->u.call.func, func->u.fun.level, attrs.level, arg_tr, isTypeCompat(result, Ty_Void())),
+    return Expty(Tr_functionCall(exp->u.call.func, func->u.fun.level, attrs.level, arg_tr, isTypeCompat(result, Ty_Void()),
+                                 attrs.tail),
                  result);
 }
 
@@ -387,7 +430,7 @@ static expty visitIfExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs attr
     A_exp then = exp->u.iff.then;
     A_exp elsee = exp->u.iff.elsee;
 
-    expty test_v = visitExp(tenv, venv, test, attrs);
+    expty test_v = visitExp(tenv, venv, test, VisitorAttrs_changeTail(attrs, FALSE));
 
     if (!isTypeCompat(test_v.ty, Ty_Int())) {
         EM_error(test->pos, "test expression must have Integer type");
@@ -457,7 +500,7 @@ static expty visitForExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs att
         return Expty(Tr_nop(), Ty_Void());
     }
 
-    Tr_access var = Tr_allocLocal(attrs.level, exp->u.forr.escape);
+    Tr_access var = Tr_allocLocal(attrs.level, exp->u.forr.escape, FALSE);
 
     S_beginScope(venv);
     S_enter(venv, id, E_LoopVarEntry(Ty_Int(), var));
@@ -488,11 +531,12 @@ static expty visitSeqExp(S_table tenv, S_table venv, A_expList exps, visitorAttr
         return Expty(Tr_nop(), Ty_Void());
     }
 
-    expty stm_v = visitExp(tenv, venv, exps->head, attrs);
     if (!exps->tail) {
-        return stm_v;
+        return visitExp(tenv, venv, exps->head, attrs);
     }
 
+    expty stm_v = visitExp(tenv, venv, exps->head, VisitorAttrs_changeTail(attrs, FALSE));
+
     expty exp_v = visitSeqExp(tenv, venv, exps->tail, attrs);
     return Expty(isTypeCompat(exp_v.ty, Ty_Void()) ? Tr_stmtSeq(stm_v.exp, exp_v.exp) : Tr_seq(stm_v.exp, exp_v.exp), exp_v.ty);
 }
@@ -520,7 +564,7 @@ static expty visitArrayExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs a
         return Expty(Tr_const(0), ty);
     }
 
-    return Expty(Tr_newArray(vsize.exp, vinit.exp), ty);
+    return Expty(Tr_newArray(vsize.exp, vinit.exp, isPointer(actual_ty->u.array), exp->pos), ty);
 }
 
 struct fieldAndInitializer_ {
@@ -570,8 +614,16 @@ static expty visitRecordExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs
     }
 
     int n = 0;
+    for (Ty_fieldList field_list = actual_ty->u.record; field_list; field_list = field_list->tail) {
+        n++;
+    }
+    string layout = checked_malloc(n + 1);
+    layout[n] = '\0';
+
+    n = 0;
     Tr_expList initializers = NULL, initializers_tail = NULL;
     for (Ty_fieldList field_list = actual_ty->u.record; field_list; field_list = field_list->tail) {
+        layout[n] = isPointer(field_list->head->ty) ? 'p' : 'i';
         fieldAndInitializer field = S_look(fieldset, field_list->head->name);
         assert(field);
         Tr_expList p = Tr_ExpList(field->initializer, NULL);
@@ -584,7 +636,7 @@ static expty visitRecordExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs
         n++;
     }
 
-    return Expty(Tr_newRecord(n, initializers), ty);
+    return Expty(Tr_newRecord(n, initializers, layout, exp->pos), ty);
 }
 
 static expty visitLetExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs attrs) {
@@ -633,7 +685,7 @@ static expty visitLetExp(S_table tenv, S_table venv, A_exp exp, visitorAttrs att
 
     for (A_decList dec_list = exp->u.let.decs; dec_list; dec_list = dec_list->tail) {
         A_dec dec = dec_list->head;
-        Tr_exp init = visitDec(tenv, venv, dec, attrs).exp;
+        Tr_exp init = visitDec(tenv, venv, dec, VisitorAttrs_changeTail(attrs, FALSE)).exp;
         if (!init) {
             // For functions/types/variable declaration without initialization, skip generate initializer
             continue;
@@ -796,9 +848,6 @@ Ty_ty visitTy(S_table tenv, S_table venv, A_ty ty) {
 }
 
 static expty visitVarDec(S_table tenv, S_table venv, A_dec dec, visitorAttrs attrs) {
-    // Allocate local variable
-    Tr_access access = Tr_allocLocal(attrs.level, dec->u.var.escape);
-
     expty init = visitExp(tenv, venv, dec->u.var.init, attrs);
     Ty_ty init_type = init.ty;
     Ty_ty init_type_actual = actualTy(init_type);
@@ -806,7 +855,7 @@ static expty visitVarDec(S_table tenv, S_table venv, A_dec dec, visitorAttrs att
     if (dec->u.var.typ == NULL) {
         if (init_type_actual->kind == Ty_void || init_type_actual->kind == Ty_nil) {
             EM_error(dec->pos, "variable declaration initializer type error");
-            S_enter(venv, dec->u.var.var, E_VarEntry(Ty_Int(), access));
+            S_enter(venv, dec->u.var.var, E_VarEntry(Ty_Int(), Tr_allocLocal(attrs.level, dec->u.var.escape, FALSE)));
             return Expty(NULL, NULL);
         }
         ty = init_type;
@@ -814,6 +863,9 @@ static expty visitVarDec(S_table tenv, S_table venv, A_dec dec, visitorAttrs att
         ty = requireSym(dec->pos, tenv, dec->u.var.typ, init_type_actual);
     }
 
+    // Allocate local variable, once its type tells whether the collector must see it
+    Tr_access access = Tr_allocLocal(attrs.level, dec->u.var.escape, isPointer(ty));
+
     if (!isTypeCompat(ty, init_type_actual)) {
         EM_error(dec->pos, "variable declaration initializer type error");
         S_enter(venv, dec->u.var.var, E_VarEntry(ty, access));
@@ -842,20 +894,40 @@ void visitFunctionDec(S_table tenv, S_table venv, A_dec dec, visitorAttrs attrs)
             }
         }
 
-        // Convert formal escape info to a U_BoolList
+        // Convert formal escape info and pointer-ness to U_BoolLists
         A_fieldList fields = fundec->params;
-        U_boolList formals = NULL, formals_tail = NULL;
-        for (; fields; fields = fields->tail) {
+        Ty_tyList types = head;
+        U_boolList formals = NULL, formals_tail = NULL, pointers = NULL, pointers_tail = NULL;
+        for (; fields; fields = fields->tail, types = types->tail) {
             if (!formals) {
                 formals = formals_tail = U_BoolList(fields->head->escape, NULL);
+                pointers = pointers_tail = U_BoolList(isPointer(types->head), NULL);
             } else {
                 formals_tail->tail = U_BoolList(fields->head->escape, NULL);
                 formals_tail = formals_tail->tail;
+                pointers_tail->tail = U_BoolList(isPointer(types->head), NULL);
+                pointers_tail = pointers_tail->tail;
+            }
+        }
+
+        // Outer variables captured by escape analysis are passed as extra formals
+        Tr_accessList captured = NULL, captured_tail = NULL;
+        for (A_symbolList syms = fundec->captured; syms; syms = syms->tail) {
+            E_enventry var = S_look(venv, syms->head);
+            assert(var && var->kind == E_varEntry);
+            if (!captured) {
+                captured = captured_tail = Tr_AccessList(var->u.var.access, NULL);
+            } else {
+                captured_tail->tail = Tr_AccessList(var->u.var.access, NULL);
+                captured_tail = captured_tail->tail;
             }
         }
 
         // Create activation record
-        Tr_level lv = Tr_newLevel(attrs.level, Temp_newlabel(), formals);
+        Temp_label label = Temp_newlabel();
+        Tr_nameFunction(label, fundec->name);
+        Tr_level lv = Tr_newLevel(attrs.level, label, formals, pointers, fundec->static_link, captured,
+                                  fundec->used);
 
         // Put it to symbol table
         S_enter(venv, fundec->name, E_FunEntry(head, result, lv));
@@ -883,7 +955,8 @@ void visitFunctionDec(S_table tenv, S_table venv, A_dec dec, visitorAttrs attrs)
         }
         assert(!formal_access && !fields && !p);
 
-        expty body_v = visitExp(tenv, venv, fundec->body, VisitorAttrs_changeLevel(attrs, e->u.fun.level));
+        expty body_v = visitExp(tenv, venv, fundec->body,
+                                VisitorAttrs_changeTail(VisitorAttrs_changeLevel(attrs, e->u.fun.level), TRUE));
         Ty_ty body_ty = body_v.ty;
         if (!isTypeCompat(e->u.fun.result, body_ty)) {
             EM_error(fundec->body->pos, "function body expression type does not match the return value type");
@@ -898,6 +971,6 @@ void visitFunctionDec(S_table tenv, S_table venv, A_dec dec, visitorAttrs attrs)
 void SEM_transProg(A_exp exp) {
     S_table tenv = E_base_tenv();
     S_table venv = E_base_venv();
-    Tr_level main_level = Tr_newLevel(Tr_outermost(), Temp_namedlabel("main"), NULL);
-    Tr_procEntryExit(main_level, visitExp(tenv, venv, exp, VisitorAttrs(main_level, NULL)).exp, NULL);
+    Tr_level main_level = Tr_newLevel(Tr_outermost(), Temp_namedlabel("main"), NULL, NULL, TRUE, NULL, TRUE);
+    Tr_procEntryExit(main_level, visitExp(tenv, venv, exp, VisitorAttrs(main_level, NULL, TRUE)).exp, NULL);
 }
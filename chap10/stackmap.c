@@ -0,0 +1,130 @@
+#include "stackmap.h"
+#include "flowgraph.h"
+#include "table.h"
+
+/*
+ * Stack maps
+ *
+ * At a call, the heap pointers of a frame are the escaping pointer variables in
+ * its slots and the pointer temps that are live across the call. The temps are
+ * marked by semant and translate, and by canon for the values it hoists; the
+ * calls define no temp of their own but ra, so the temps live out of a call are
+ * exactly those that must survive it.
+ *
+ * The runtime looks a map up by the return address it finds in a frame.
+ */
+
+typedef struct site_ *site;
+struct site_ {
+    AS_instr call;
+    Temp_label ret;         // Label at the return address
+    Temp_tempList live;     // Pointer temps live across the call
+    site next;
+};
+
+struct SM_map_ {
+    F_frame frame;
+    site sites, last;
+    TAB_table by_call;      // Map call instruction to its site
+};
+
+static int n_site, n_slot, n_temp;
+
+static int nSlot(F_frame frame) {
+    int n = 0;
+    for (F_accessList p = frame->pointers; p; p = p->tail) {
+        n++;
+    }
+    return n;
+}
+
+static bool isCall(AS_instr i) {
+    return i->kind == I_OPER && (i->op == AS_JAL || i->op == AS_JALR);
+}
+
+SM_map SM_stackMap(F_frame frame, G_graph flow, LV_graph live) {
+    SM_map map = checked_malloc(sizeof(*map));
+    map->frame = frame;
+    map->sites = map->last = NULL;
+    map->by_call = TAB_empty();
+
+    int slots = nSlot(frame);
+    for (G_nodeList nodes = G_nodes(flow); nodes; nodes = nodes->tail) {
+        AS_instr i = FG_instr(nodes->head);
+        if (!isCall(i)) {
+            continue;
+        }
+        site s = checked_malloc(sizeof(*s));
+        s->call = i;
+        s->ret = NULL;
+        s->live = NULL;
+        s->next = NULL;
+        for (Temp_tempList l = G_look(live.out, nodes->head); l; l = l->tail) {
+            if (l->head->pointer) {
+                s->live = Temp_TempList(l->head, s->live);
+                n_temp++;
+            }
+        }
+        if (map->last) {
+            map->last->next = s;
+        } else {
+            map->sites = s;
+        }
+        map->last = s;
+        TAB_enter(map->by_call, i, s);
+        n_site++;
+        n_slot += slots;
+    }
+    return map;
+}
+
+AS_instrList SM_placeLabels(SM_map map, AS_instrList il, bool delay_slots) {
+    for (AS_instrList l = il; l; l = l->tail) {
+        site s = TAB_look(map->by_call, l->head);
+        if (!s) {
+            continue;
+        }
+        AS_instrList at = delay_slots && l->tail ? l->tail : l;
+        s->ret = Temp_newlabel();
+        at->tail = AS_InstrList(AS_Label(s->ret), at->tail);
+        l = at->tail;
+    }
+    return il;
+}
+
+void SM_print(FILE *out, SM_map map, Temp_map names) {
+    if (!map->sites) {
+        return;
+    }
+    int slots = nSlot(map->frame);
+    fprintf(out, ".data\n%s_stackmap:\n", Temp_labelstring(F_name(map->frame)));
+    int n = 0;
+    for (site s = map->sites; s; s = s->next) {
+        n++;
+    }
+    fprintf(out, "    .word %d\n", n);
+    for (site s = map->sites; s; s = s->next) {
+        assert(s->ret);
+        fprintf(out, "    .word %s, %d", Temp_labelstring(s->ret), slots);
+        for (F_accessList p = map->frame->pointers; p; p = p->tail) {
+            fprintf(out, ", %d", F_offset(p->head));
+        }
+        int temps = 0;
+        for (Temp_tempList l = s->live; l; l = l->tail) {
+            temps++;
+        }
+        fprintf(out, ", %d", temps);
+        if (temps) {
+            fprintf(out, "    #");
+            for (Temp_tempList l = s->live; l; l = l->tail) {
+                fprintf(out, " %s", Temp_look(names, l->head));
+            }
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, ".text\n\n");
+}
+
+void SM_report(FILE *out) {
+    fprintf(out, "stackmap: %d call sites, %d pointer slots, %d pointer temps\n", n_site, n_slot, n_temp);
+}
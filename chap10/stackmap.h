@@ -0,0 +1,40 @@
+/*
+ * stackmap.h - per-call-site maps of the heap pointers of a frame, for a precise collector
+ */
+
+#ifndef TIGER_STACKMAP
+#define TIGER_STACKMAP
+
+#include <stdio.h>
+#include "assem.h"
+#include "frame.h"
+#include "graph.h"
+#include "liveness.h"
+
+typedef struct SM_map_ *SM_map;
+
+/*
+ * Find, for each call of the flow graph that returns, the pointer temps live
+ * across it by the liveness computed on the graph. The pointer slots of the
+ * frame are listed at every call.
+ */
+SM_map SM_stackMap(F_frame frame, G_graph flow, LV_graph live);
+
+/*
+ * Put a label at the return address of each call of il: right after it, or after
+ * its delay slot if the list is meant for ".set noreorder"
+ */
+AS_instrList SM_placeLabels(SM_map map, AS_instrList il, bool delay_slots);
+
+/*
+ * Print the table of the calls of one function: the number of calls, then for
+ * each its return address, the number of pointer slots and their offsets from
+ * the frame pointer, and the number of pointer temps. The temps are named in a
+ * comment until a register allocator gives them registers.
+ */
+void SM_print(FILE *out, SM_map map, Temp_map names);
+
+// Report the call sites and pointer roots mapped so far
+void SM_report(FILE *out);
+
+#endif //TIGER_STACKMAP
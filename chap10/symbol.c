@@ -3,16 +3,20 @@
 #include "table.h"
 #include "symbol.h"
 
+static int count = 0;
+
 static S_symbol mksymbol(string name, S_symbol next) {
     S_symbol s = checked_malloc(sizeof(*s));
     s->name = name;
     s->next = next;
+    s->num = count++;
     return s;
 }
 
-#define SIZE 109  /* should be prime */
+/* Grows with the symbols, as compiling a large function makes a label per branch */
+static int size = 109;
 
-static S_symbol hashtable[SIZE];
+static S_symbol *hashtable = NULL;
 
 static unsigned int hash(char *s0) {
     unsigned int h = 0;
@@ -26,8 +30,29 @@ static int streq(string a, string b) {
     return !strcmp(a, b);
 }
 
+static void rehash(int new_size) {
+    S_symbol *old = hashtable;
+    int old_size = size;
+    hashtable = checked_malloc(new_size * sizeof(S_symbol));
+    size = new_size;
+    for (int i = 0; i < size; i++)
+        hashtable[i] = NULL;
+    for (int i = 0; old && i < old_size; i++) {
+        for (S_symbol sym = old[i], next; sym; sym = next) {
+            int index = hash(sym->name) % size;
+            next = sym->next;
+            sym->next = hashtable[index];
+            hashtable[index] = sym;
+        }
+    }
+}
+
 S_symbol S_Symbol(string name) {
-    int index = hash(name) % SIZE;
+    if (!hashtable)
+        rehash(size);
+    else if (count > 2 * size)
+        rehash(2 * size + 1);
+    int index = hash(name) % size;
     S_symbol syms = hashtable[index], sym;
     for (sym = syms; sym; sym = sym->next)
         if (streq(sym->name, name)) return sym;
@@ -36,6 +61,10 @@ S_symbol S_Symbol(string name) {
     return sym;
 }
 
+int S_count(void) {
+    return count;
+}
+
 string S_name(S_symbol sym) {
     return sym->name;
 }
@@ -52,7 +81,7 @@ void *S_look(S_table t, S_symbol sym) {
     return TAB_look(t, sym);
 }
 
-static struct S_symbol_ marksym = {"<mark>", 0};
+static struct S_symbol_ marksym = {"<mark>", 0, -1};
 
 void S_beginScope(S_table t) {
     S_enter(t, &marksym, NULL);
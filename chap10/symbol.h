@@ -13,6 +13,7 @@ typedef struct S_symbol_ *S_symbol;
 struct S_symbol_ {
     string name;
     S_symbol next;
+    int num;        /* order of creation, from 0 */
 };
 
 /* Make a unique symbol from a given string.  
@@ -20,6 +21,9 @@ struct S_symbol_ {
  *  value, even if the "foo" strings are at different locations. */
 S_symbol S_Symbol(string);
 
+/* The number of symbols made so far, so one more than the largest num */
+int S_count(void);
+
 /* Extract the underlying string from a symbol */
 string S_name(S_symbol);
 
@@ -35,10 +35,11 @@ static int temps = 100;
 Temp_temp Temp_newtemp(void) {
     Temp_temp p = (Temp_temp) checked_malloc(sizeof(*p));
     p->num = temps++;
+    p->pointer = FALSE;
     {
         char r[16];
         sprintf(r, "$t%d", p->num);
-        Temp_enter(Temp_name(), p, String(r));
+        p->name = String(r);
     }
     return p;
 }
@@ -84,6 +85,7 @@ string Temp_look(Temp_map m, Temp_temp t) {
     s = TAB_look(m->tab, t);
     if (s) return s;
     else if (m->under) return Temp_look(m->under, t);
+    else if (m->tab == Temp_name()->tab) return t->name;
     else return NULL;
 }
 
@@ -12,6 +12,8 @@
 
 struct Temp_temp_ {
     int num;
+    bool pointer;   // Holds a heap pointer, to be listed in the stack maps
+    string name;    // Its name in Temp_name(), kept here rather than in the table
 };
 
 typedef struct Temp_temp_ *Temp_temp;
@@ -0,0 +1,447 @@
+/*
+ * burg.c - generate a bottom-up rewrite (BURS) instruction selector from a tree grammar
+ *
+ * usage: burg grammar.brg output.h
+ *
+ * Each line of the grammar is a rule
+ *
+ *   Name  cost  pattern
+ *
+ * and '#' starts a comment. A pattern is a tree of IR operators:
+ *
+ *   e                      any expression, computed into a register by its own rule
+ *   CONST, CONST[pred]     a constant (for which the C function pred(int) holds)
+ *   NAME, TEMP             a label or a temp
+ *   MEM(p)
+ *   BINOP(op, p, p)        op is PLUS, MINUS, MUL, DIV, AND, OR, LSHIFT, RSHIFT, ARSHIFT, XOR, SLT or SLTU
+ *   CALL(p), TAILCALL(p)   the function of a call; every argument is an e
+ *   MOVE(p, p), EXP(p), JUMP(p), LABEL
+ *   CJUMP(op, p, p)        op is EQ, NE, LT, GT, LE, GE, ULT, ULE, UGT or UGE
+ *
+ * The output, included by the code generator of the architecture, holds the
+ * table F_rules[] binding rule Name to the generator genName, and the labellers
+ * F_matchExp/F_matchStm. A labeller switches on the kind and operator of the node,
+ * tries only the rules rooted there, and records the cheapest one in the node,
+ * assuming the children are labelled already. Earlier rules win ties.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+#define MAX_RULES 256
+#define MAX_CODE 1024
+
+typedef struct pat_ *pat;
+
+struct pat_ {
+    string op;          // Operator, or "e" for the nonterminal
+    string sub;         // Operator of BINOP and CJUMP, predicate of CONST
+    pat kids[2];
+    int n_kid;
+};
+
+typedef struct {
+    string name;
+    int cost;
+    pat pattern;
+    string text;
+    int line;
+} rule;
+
+static rule rules[MAX_RULES];
+static int n_rule = 0;
+
+static string file_name;
+static int line_no;
+
+static void fail(string msg) {
+    fprintf(stderr, "%s:%d: %s\n", file_name, line_no, msg);
+    exit(1);
+}
+
+/*
+ * Operators
+ */
+
+static struct {
+    string name;
+    int arity;
+    bool stm;           // Root of a statement pattern
+    string kind;        // Tree kind tested for it
+} ops[] = {
+        {"CONST", 0, FALSE, "T_CONST"},
+        {"NAME", 0, FALSE, "T_NAME"},
+        {"TEMP", 0, FALSE, "T_TEMP"},
+        {"MEM", 1, FALSE, "T_MEM"},
+        {"BINOP", 2, FALSE, "T_BINOP"},
+        {"CALL", 1, FALSE, "T_CALL"},
+        {"TAILCALL", 1, FALSE, "T_CALL"},
+        {"MOVE", 2, TRUE, "T_MOVE"},
+        {"EXP", 1, TRUE, "T_EXP"},
+        {"JUMP", 1, TRUE, "T_JUMP"},
+        {"CJUMP", 2, TRUE, "T_CJUMP"},
+        {"LABEL", 0, TRUE, "T_LABEL"},
+};
+
+static struct {
+    string name;
+    string c;
+} binops[] = {
+        {"PLUS", "T_plus"}, {"MINUS", "T_minus"}, {"MUL", "T_mul"}, {"DIV", "T_div"},
+        {"AND", "T_and"}, {"OR", "T_or"}, {"LSHIFT", "T_lshift"}, {"RSHIFT", "T_rshift"},
+        {"ARSHIFT", "T_arshift"}, {"XOR", "T_xor"}, {"SLT", "T_slt"}, {"SLTU", "T_sltu"},
+}, relops[] = {
+        {"EQ", "T_eq"}, {"NE", "T_ne"}, {"LT", "T_lt"}, {"GT", "T_gt"}, {"LE", "T_le"},
+        {"GE", "T_ge"}, {"ULT", "T_ult"}, {"ULE", "T_ule"}, {"UGT", "T_ugt"}, {"UGE", "T_uge"},
+};
+
+#define N_OF(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+static int findOp(string name) {
+    for (int i = 0; i < N_OF(ops); i++) {
+        if (!strcmp(ops[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static string subOpC(string op, string sub) {
+    if (!strcmp(op, "BINOP")) {
+        for (int i = 0; i < N_OF(binops); i++) {
+            if (!strcmp(binops[i].name, sub)) {
+                return binops[i].c;
+            }
+        }
+    } else {
+        for (int i = 0; i < N_OF(relops); i++) {
+            if (!strcmp(relops[i].name, sub)) {
+                return relops[i].c;
+            }
+        }
+    }
+    fail("unknown operator");
+    return NULL;
+}
+
+/*
+ * Parsing
+ */
+
+static char *cur;
+
+static void skipSpace() {
+    while (*cur == ' ' || *cur == '\t') {
+        cur++;
+    }
+}
+
+static string ident() {
+    skipSpace();
+    char *start = cur;
+    while (*cur == '_' || (*cur >= 'a' && *cur <= 'z') || (*cur >= 'A' && *cur <= 'Z')
+           || (*cur >= '0' && *cur <= '9')) {
+        cur++;
+    }
+    if (cur == start) {
+        fail("identifier expected");
+    }
+    string s = checked_malloc(cur - start + 1);
+    memcpy(s, start, cur - start);
+    s[cur - start] = '\0';
+    return s;
+}
+
+static void expect(char c) {
+    skipSpace();
+    if (*cur != c) {
+        char msg[32];
+        sprintf(msg, "'%c' expected", c);
+        fail(msg);
+    }
+    cur++;
+}
+
+static pat parsePat() {
+    pat p = checked_malloc(sizeof(*p));
+    p->op = ident();
+    p->sub = NULL;
+    p->n_kid = 0;
+    if (!strcmp(p->op, "e")) {
+        return p;
+    }
+
+    int op = findOp(p->op);
+    if (op < 0) {
+        fail("unknown operator");
+    }
+
+    skipSpace();
+    if (!strcmp(p->op, "CONST") && *cur == '[') {
+        cur++;
+        p->sub = ident();
+        expect(']');
+    }
+    if (ops[op].arity == 0) {
+        return p;
+    }
+
+    expect('(');
+    if (!strcmp(p->op, "BINOP") || !strcmp(p->op, "CJUMP")) {
+        p->sub = subOpC(p->op, ident());
+        expect(',');
+    }
+    for (int i = 0; i < ops[op].arity; i++) {
+        if (i) {
+            expect(',');
+        }
+        p->kids[p->n_kid++] = parsePat();
+    }
+    expect(')');
+    return p;
+}
+
+static void parseLine(char *line) {
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+    cur = line;
+    skipSpace();
+    if (*cur == '\0' || *cur == '\n' || *cur == '\r') {
+        return;
+    }
+
+    if (n_rule == MAX_RULES) {
+        fail("too many rules");
+    }
+    rule *r = &rules[n_rule++];
+    r->line = line_no;
+    r->name = ident();
+    skipSpace();
+    r->cost = (int) strtol(cur, &cur, 10);
+    skipSpace();
+    r->text = String(cur);
+    for (int n = strlen(r->text); n > 0 && strchr(" \t\r\n", r->text[n - 1]); n--) {
+        r->text[n - 1] = '\0';
+    }
+    r->pattern = parsePat();
+    skipSpace();
+    if (*cur != '\0' && *cur != '\n' && *cur != '\r') {
+        fail("junk after pattern");
+    }
+    if (!strcmp(r->pattern->op, "e")) {
+        fail("a pattern cannot be a bare e");
+    }
+}
+
+/*
+ * Code generation
+ */
+
+static bool isStm(rule *r) {
+    return ops[findOp(r->pattern->op)].stm;
+}
+
+static void append(char *buf, string s) {
+    if (strlen(buf) + strlen(s) >= MAX_CODE) {
+        fail("pattern too large");
+    }
+    strcat(buf, s);
+}
+
+/*
+ * Build the condition under which the pattern matches the node at path, and the
+ * sum of the costs of its e leaves. The root kind and operator are not tested,
+ * since the labeller switches on them.
+ */
+static void genPat(pat p, string path, bool root, char *cond, char *cost) {
+    char buf[MAX_CODE];
+    if (!strcmp(p->op, "e")) {
+        sprintf(buf, " + %s->cost", path);
+        append(cost, buf);
+        return;
+    }
+
+    int op = findOp(p->op);
+    if (!root) {
+        sprintf(buf, " && %s->kind == %s", path, ops[op].kind);
+        append(cond, buf);
+        if (p->sub && strcmp(p->op, "CONST")) {
+            sprintf(buf, " && %s->u.%s.op == %s", path, p->op, p->sub);
+            append(cond, buf);
+        }
+    }
+    if (!strcmp(p->op, "CONST") && p->sub) {
+        sprintf(buf, " && %s(%s->u.CONST)", p->sub, path);
+        append(cond, buf);
+    }
+
+    static string kid_fmt[][2] = {
+            {"MEM", "%s->u.MEM"},
+            {"EXP", "%s->u.EXP"},
+            {"JUMP", "%s->u.JUMP.exp"},
+            {"CALL", "%s->u.CALL.fun"},
+            {"TAILCALL", "%s->u.CALL.fun"},
+    };
+    if (!strcmp(p->op, "CALL") || !strcmp(p->op, "TAILCALL")) {
+        sprintf(buf, " && %s%s->u.CALL.tail", strcmp(p->op, "CALL") ? "" : "!", path);
+        append(cond, buf);
+        sprintf(buf, " + F_argsCost(%s->u.CALL.args)", path);
+        append(cost, buf);
+    }
+    if (p->n_kid == 1) {
+        for (int i = 0; i < N_OF(kid_fmt); i++) {
+            if (!strcmp(kid_fmt[i][0], p->op)) {
+                sprintf(buf, kid_fmt[i][1], path);
+            }
+        }
+        genPat(p->kids[0], buf, FALSE, cond, cost);
+    } else if (p->n_kid == 2) {
+        string field = !strcmp(p->op, "MOVE") ? "MOVE" : p->op;
+        string l = !strcmp(p->op, "MOVE") ? "dst" : "left", r = !strcmp(p->op, "MOVE") ? "src" : "right";
+        char kid[MAX_CODE];
+        sprintf(kid, "%s->u.%s.%s", path, field, l);
+        genPat(p->kids[0], kid, FALSE, cond, cost);
+        sprintf(kid, "%s->u.%s.%s", path, field, r);
+        genPat(p->kids[1], kid, FALSE, cond, cost);
+    }
+}
+
+static void genRule(FILE *out, int i, string node, string indent) {
+    rule *r = &rules[i];
+    char cond[MAX_CODE] = "", cost[MAX_CODE] = "";
+    line_no = r->line;
+    genPat(r->pattern, node, TRUE, cond, cost);
+
+    fprintf(out, "%s// %s: %s\n", indent, r->name, r->text);
+    string in = indent;
+    char inner[64];
+    if (cond[0]) {
+        fprintf(out, "%sif (%s) {\n", indent, cond + strlen(" && "));
+        sprintf(inner, "%s    ", indent);
+        in = inner;
+    }
+    fprintf(out, "%sc = %d%s;\n", in, r->cost, cost);
+    fprintf(out, "%sif (%s->selection == -1 || c < %s->cost) {\n", in, node, node);
+    fprintf(out, "%s    %s->cost = c;\n", in, node);
+    fprintf(out, "%s    %s->selection = %d;\n", in, node, i);
+    fprintf(out, "%s}\n", in);
+    if (cond[0]) {
+        fprintf(out, "%s}\n", indent);
+    }
+}
+
+// Emit the cases of one labeller, grouped by root kind and then by root operator
+static void genMatcher(FILE *out, bool stm) {
+    string node = stm ? "stm" : "exp";
+    fprintf(out, "void F_match%s(T_%s %s) {\n", stm ? "Stm" : "Exp", node, node);
+    fprintf(out, "    int c;\n");
+    fprintf(out, "    %s->cost = -1;\n", node);
+    fprintf(out, "    %s->selection = -1;\n", node);
+    fprintf(out, "    switch (%s->kind) {\n", node);
+
+    bool kind_done[N_OF(ops)] = {FALSE};
+    for (int i = 0; i < n_rule; i++) {
+        if (isStm(&rules[i]) != stm) {
+            continue;
+        }
+        int op = findOp(rules[i].pattern->op);
+        string kind = ops[op].kind;
+        bool seen = FALSE;
+        for (int k = 0; k < N_OF(ops); k++) {
+            seen |= kind_done[k] && !strcmp(ops[k].kind, kind);
+        }
+        if (seen) {
+            continue;
+        }
+        kind_done[op] = TRUE;
+
+        fprintf(out, "        case %s:\n", kind);
+        bool has_sub = !strcmp(rules[i].pattern->op, "BINOP") || !strcmp(rules[i].pattern->op, "CJUMP");
+        if (!has_sub) {
+            for (int j = i; j < n_rule; j++) {
+                if (isStm(&rules[j]) == stm && !strcmp(ops[findOp(rules[j].pattern->op)].kind, kind)) {
+                    genRule(out, j, node, "            ");
+                }
+            }
+            fprintf(out, "            break;\n\n");
+            continue;
+        }
+
+        // Rules rooted at BINOP or CJUMP are further keyed on the operator
+        fprintf(out, "            switch (%s->u.%s.op) {\n", node, rules[i].pattern->op);
+        for (int j = i; j < n_rule; j++) {
+            if (isStm(&rules[j]) != stm || strcmp(rules[j].pattern->op, rules[i].pattern->op)) {
+                continue;
+            }
+            bool sub_seen = FALSE;
+            for (int k = i; k < j; k++) {
+                sub_seen |= isStm(&rules[k]) == stm && !strcmp(rules[k].pattern->op, rules[i].pattern->op)
+                            && !strcmp(rules[k].pattern->sub, rules[j].pattern->sub);
+            }
+            if (sub_seen) {
+                continue;
+            }
+            fprintf(out, "                case %s:\n", rules[j].pattern->sub);
+            for (int k = j; k < n_rule; k++) {
+                if (isStm(&rules[k]) == stm && !strcmp(rules[k].pattern->op, rules[i].pattern->op)
+                    && !strcmp(rules[k].pattern->sub, rules[j].pattern->sub)) {
+                    genRule(out, k, node, "                    ");
+                }
+            }
+            fprintf(out, "                    break;\n\n");
+        }
+        fprintf(out, "                default:;\n");
+        fprintf(out, "            }\n");
+        fprintf(out, "            break;\n\n");
+    }
+
+    fprintf(out, "        default:;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n\n");
+}
+
+static void genRules(FILE *out, string grammar) {
+    fprintf(out, "/*\n * Generated by burg from %s - do not edit.\n */\n\n", grammar);
+    fprintf(out, "F_rule F_rules[] = {\n");
+    for (int i = 0; i < n_rule; i++) {
+        fprintf(out, "        {%s, {.%s = gen%s}, \"%s\"},\n", isStm(&rules[i]) ? "RULE_STM" : "RULE_EXP",
+                isStm(&rules[i]) ? "stm" : "exp", rules[i].name, rules[i].name);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "int F_nRule = %d;\n\n", n_rule);
+    genMatcher(out, FALSE);
+    genMatcher(out, TRUE);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: burg grammar.brg output.h\n");
+        return 1;
+    }
+
+    file_name = argv[1];
+    FILE *in = fopen(file_name, "r");
+    if (!in) {
+        perror(file_name);
+        return 1;
+    }
+    char line[MAX_CODE];
+    for (line_no = 1; fgets(line, sizeof(line), in); line_no++) {
+        parseLine(line);
+    }
+    fclose(in);
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    string base = strrchr(file_name, '/');
+    genRules(out, base ? base + 1 : file_name);
+    fclose(out);
+    return 0;
+}
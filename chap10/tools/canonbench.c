@@ -0,0 +1,73 @@
+/*
+ * canonbench.c - time the canonicalizer on generated function bodies of growing size
+ *
+ * usage: canonbench [max_stms]
+ *
+ * A body is a right-nested SEQ, as translate builds it, of small loops: a label,
+ * a move, a store of an ESEQ, a call with an ESEQ argument, a CJUMP back to the
+ * label and the label of the exit. For 1000, 10000, ... statements up to max_stms
+ * (a million by default), the time of C_linearize and C_basicBlocks is reported,
+ * then that of C_traceSchedule and of C_layoutSchedule, each on a fresh body.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "util.h"
+#include "symbol.h"
+#include "temp.h"
+#include "tree.h"
+#include "canon.h"
+
+#define STMS_PER_LOOP 6
+
+static T_stm body(int n) {
+    Temp_temp i = Temp_newtemp(), t = Temp_newtemp();
+    Temp_label f = Temp_namedlabel("f");
+    T_stm result = T_Exp(T_Const(0));
+    for (int k = n / STMS_PER_LOOP - 1; k >= 0; k--) {
+        Temp_label top = Temp_newlabel(), next = Temp_newlabel();
+        T_stm loop[STMS_PER_LOOP] = {
+                T_Label(top),
+                T_Move(T_Temp(i), T_Binop(T_plus, T_Temp(i), T_Const(1))),
+                T_Move(T_Mem(T_Binop(T_plus, T_Temp(i), T_Const(4 * (k % 64)))),
+                       T_Eseq(T_Move(T_Temp(t), T_Const(k)), T_Binop(T_mul, T_Temp(t), T_Temp(i)))),
+                T_Exp(T_Call(T_Name(f), T_ExpList(T_Temp(i), T_ExpList(T_Eseq(T_Move(T_Temp(t), T_Temp(i)),
+                                                                              T_Temp(t)), NULL)))),
+                T_Cjump(T_lt, T_Temp(i), T_Const(10), top, next),
+                T_Label(next),
+        };
+        for (int s = STMS_PER_LOOP - 1; s >= 0; s--) {
+            result = T_Seq(loop[s], result);
+        }
+    }
+    return result;
+}
+
+static double since(clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, string *argv) {
+    int max = argc > 1 ? atoi(argv[1]) : 1000000;
+    printf("%10s %10s %10s %10s %10s\n", "stms", "linearize", "blocks", "trace", "layout");
+    for (int n = 1000; n <= max; n *= 10) {
+        T_stm s = body(n);
+        clock_t start = clock();
+        T_stmList stms = C_linearize(s);
+        double linearize = since(start);
+        start = clock();
+        struct C_block b = C_basicBlocks(stms);
+        double blocks = since(start);
+        start = clock();
+        C_traceSchedule(b);
+        double trace = since(start);
+
+        b = C_basicBlocks(C_linearize(body(n)));
+        start = clock();
+        C_layoutSchedule(b);
+        double layout = since(start);
+        printf("%10d %10.3f %10.3f %10.3f %10.3f\n", n, linearize, blocks, trace, layout);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * codegenbench.c - time instruction selection and printing on generated function bodies of growing size
+ *
+ * usage: codegenbench [max_stms]
+ *
+ * A body is a canonical statement list, as canon leaves it, of small loops: a label,
+ * arithmetic with registers and immediates, a multiply and a divide, a load and a store,
+ * a call and a CJUMP back to the label, followed by the label of the exit. For 1000,
+ * 10000, ... statements up to max_stms (a million by default), the number of instructions
+ * and the time of F_codegen and of AS_printInstrList (to a temporary file) are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "util.h"
+#include "symbol.h"
+#include "temp.h"
+#include "tree.h"
+#include "assem.h"
+#include "frame.h"
+#include "codegen.h"
+
+#define STMS_PER_LOOP 10
+
+static T_stmList body(int n) {
+    Temp_temp i = Temp_newtemp(), t = Temp_newtemp(), u = Temp_newtemp();
+    Temp_label f = Temp_namedlabel("f");
+    T_stmList result = NULL;
+    for (int k = n / STMS_PER_LOOP - 1; k >= 0; k--) {
+        Temp_label top = Temp_newlabel(), next = Temp_newlabel();
+        T_stm loop[STMS_PER_LOOP] = {
+                T_Label(top),
+                T_Move(T_Temp(i), T_Binop(T_plus, T_Temp(i), T_Const(1))),
+                T_Move(T_Temp(t), T_Binop(T_minus, T_Temp(i), T_Temp(u))),
+                T_Move(T_Temp(u), T_Binop(T_mul, T_Temp(t), T_Const(k))),
+                T_Move(T_Temp(t), T_Binop(T_div, T_Temp(u), T_Temp(i))),
+                T_Move(T_Temp(u), T_Mem(T_Binop(T_plus, T_Temp(t), T_Const(4 * (k % 64))))),
+                T_Move(T_Mem(T_Binop(T_plus, T_Temp(i), T_Const(4 * (k % 64)))), T_Temp(u)),
+                T_Exp(T_Call(T_Name(f), T_ExpList(T_Temp(i), T_ExpList(T_Const(k), NULL)))),
+                T_Cjump(T_lt, T_Temp(i), T_Temp(t), top, next),
+                T_Label(next),
+        };
+        for (int s = STMS_PER_LOOP - 1; s >= 0; s--) {
+            result = T_StmList(loop[s], result);
+        }
+    }
+    return result;
+}
+
+static double since(clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, string *argv) {
+    int max = argc > 1 ? atoi(argv[1]) : 1000000;
+    FILE *out = tmpfile();
+    if (!out) {
+        perror("tmpfile");
+        return 1;
+    }
+    printf("%10s %12s %10s %10s\n", "stms", "instructions", "select", "print");
+    for (int n = 1000; n <= max; n *= 10) {
+        F_frame frame = F_newFrame(Temp_namedlabel("bench"), NULL, NULL);
+        T_stmList stms = body(n);
+        clock_t start = clock();
+        AS_instrList il = F_codegen(frame, stms);
+        double select = since(start);
+        int instrs = 0;
+        for (AS_instrList l = il; l; l = l->tail) {
+            instrs++;
+        }
+        rewind(out);
+        start = clock();
+        AS_printInstrList(out, il, Temp_layerMap(F_TempMap(), Temp_name()));
+        fflush(out);
+        double print = since(start);
+        printf("%10d %12d %10.3f %10.3f\n", n, instrs, select, print);
+    }
+    fclose(out);
+    return 0;
+}
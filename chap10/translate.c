@@ -2,13 +2,18 @@
  * translate.c - translate code to IR
  */
 
+#include <string.h>
 #include "translate.h"
 #include "frame.h"
 #include "tree.h"
-
-#define SL_OFFSET (-4)
+#include "table.h"
+#include "errormsg.h"
 
 static F_fragList frags = NULL, frags_tail = NULL;
+static S_table literals = NULL;         // Label of each string literal, by its text
+static TAB_table literal_text = NULL;   // Text of each literal, by its label
+static TAB_table fun_names = NULL;      // Source name of each function, by its label
+static bool profile = FALSE;            // Pass allocation sites to the runtime, see Tr_profileAllocations
 
 static void insertFrag(F_frag frag) {
     F_fragList node = F_FragList(frag, NULL);
@@ -31,7 +36,8 @@ static Cx newCx(patchList trues, patchList falses, T_stm stm) {
     Cx p = {
             .trues = trues,
             .falses = falses,
-            .stm = stm
+            .stm = stm,
+            .value = NULL
     };
     return p;
 }
@@ -80,9 +86,112 @@ static Tr_exp Tr_Cx(patchList trues, patchList falses, T_stm stm) {
     p->u.cx.stm = stm;
     p->u.cx.trues = trues;
     p->u.cx.falses = falses;
+    p->u.cx.value = NULL;
+    return p;
+}
+
+// Whether evaluating e may call a function or do anything else than read memory and compute
+static bool hasEffects(T_exp e) {
+    switch (e->kind) {
+        case T_BINOP:
+            return hasEffects(e->u.BINOP.left) || hasEffects(e->u.BINOP.right);
+        case T_MEM:
+            return hasEffects(e->u.MEM);
+        case T_CONST: case T_NAME: case T_TEMP:
+            return FALSE;
+        default:
+            return TRUE;
+    }
+}
+
+/*
+ * Whether e is small enough to be computed even where it was not asked for:
+ * no effects, no division, which may trap, and no loads but from the frame,
+ * as a record or array pointer may be nil.
+ */
+static bool isCheap(T_exp e, int *budget) {
+    if (--*budget < 0) {
+        return FALSE;
+    }
+    switch (e->kind) {
+        case T_CONST: case T_NAME: case T_TEMP:
+            return TRUE;
+        case T_BINOP:
+            return e->u.BINOP.op != T_div && isCheap(e->u.BINOP.left, budget) && isCheap(e->u.BINOP.right, budget);
+        case T_MEM: {
+            T_exp a = e->u.MEM;
+            return a->kind == T_BINOP && a->u.BINOP.op == T_plus && a->u.BINOP.left->kind == T_TEMP
+                   && a->u.BINOP.left->u.TEMP == F_FP() && a->u.BINOP.right->kind == T_CONST;
+        }
+        default:
+            return FALSE;
+    }
+}
+
+// The interned text of a string literal, or NULL if e is not one
+static string literalOf(Tr_exp e) {
+    if (e->kind != Tr_ex || e->u.ex->kind != T_NAME || !literal_text) {
+        return NULL;
+    }
+    return TAB_look(literal_text, e->u.ex->u.NAME);
+}
+
+#define CHEAP_NODES 12
+
+/*
+ * l op r as a conditional jump, which also knows its value as 1 or 0 by
+ * set-on-less-than. Where gt and le swap the operands, l is kept first by a
+ * temp if they might see each other's effects.
+ */
+static Tr_exp relCx(T_relOp op, T_exp l, T_exp r) {
+    T_stm stm = T_Cjump(op, l, r, NULL, NULL);
+    Tr_exp p = Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
+    T_exp diff = r->kind == T_CONST && r->u.CONST == 0 ? l : T_Binop(T_xor, l, r);
+    T_stm first = NULL;
+    if ((op == T_gt || op == T_le) && (hasEffects(l) || hasEffects(r)) && l->kind != T_CONST && r->kind != T_CONST) {
+        Temp_temp t = Temp_newtemp();
+        first = T_Move(T_Temp(t), l);
+        l = T_Temp(t);
+    }
+    switch (op) {
+        case T_eq:
+            p->u.cx.value = T_Binop(T_sltu, diff, T_Const(1));
+            break;
+        case T_ne:
+            p->u.cx.value = T_Binop(T_sltu, T_Const(0), diff);
+            break;
+        case T_lt:
+            p->u.cx.value = T_Binop(T_slt, l, r);
+            break;
+        case T_ge:
+            p->u.cx.value = T_Binop(T_xor, T_Binop(T_slt, l, r), T_Const(1));
+            break;
+        case T_gt:
+            p->u.cx.value = T_Binop(T_slt, r, l);
+            break;
+        case T_le:
+            p->u.cx.value = T_Binop(T_xor, T_Binop(T_slt, r, l), T_Const(1));
+            break;
+        default:
+            assert(0);
+    }
+    if (first) {
+        p->u.cx.value = T_Eseq(first, p->u.cx.value);
+    }
     return p;
 }
 
+// The value of a condition as 1 or 0 without branches, or NULL
+static T_exp boolValue(Tr_exp exp) {
+    if (exp->kind == Tr_cx) {
+        return exp->u.cx.value;
+    }
+    if (exp->kind == Tr_ex) {
+        return T_Binop(T_sltu, T_Const(0), exp->u.ex);
+    }
+    return NULL;
+}
+
 static T_exp convertToEx(Tr_exp exp) {
     switch (exp->kind) {
         case Tr_ex:
@@ -92,6 +201,9 @@ static T_exp convertToEx(Tr_exp exp) {
             return T_Eseq(exp->u.nx, T_Const(0));
 
         case Tr_cx: {
+            if (exp->u.cx.value) {
+                return exp->u.cx.value;
+            }
             Temp_temp r = Temp_newtemp();
             Temp_label t = Temp_newlabel(), f = Temp_newlabel();
             doPatch(exp->u.cx.trues, t);
@@ -154,7 +266,7 @@ static Cx convertToCx(Tr_exp exp) {
     }
 }
 
-static struct Tr_level_ troutmost = {NULL, NULL};
+static struct Tr_level_ troutmost = {NULL, NULL, NULL, NULL, FALSE, NULL, NULL, TRUE};
 
 Tr_access Tr_Access(Tr_level level, F_access access) {
     Tr_access p = checked_malloc(sizeof(*p));
@@ -172,10 +284,47 @@ Tr_accessList Tr_AccessList(Tr_access head, Tr_accessList tail) {
 
 Tr_level Tr_outermost() { return &troutmost; }
 
-Tr_level Tr_newLevel(Tr_level parent, Temp_label name, U_boolList formals) {
+void Tr_nameFunction(Temp_label label, S_symbol name) {
+    if (!fun_names) {
+        fun_names = TAB_empty();
+    }
+    TAB_enter(fun_names, label, name);
+}
+
+string Tr_functionName(Temp_label label) {
+    S_symbol name = fun_names ? TAB_look(fun_names, label) : NULL;
+    if (!name) {
+        return Temp_labelstring(label);
+    }
+    string s = checked_malloc(strlen(S_name(name)) + strlen(Temp_labelstring(label)) + 4);
+    sprintf(s, "%s (%s)", S_name(name), Temp_labelstring(label));
+    return s;
+}
+
+Tr_level Tr_newLevel(Tr_level parent, Temp_label name, U_boolList formals, U_boolList pointers, bool static_link,
+                     Tr_accessList captured, bool used) {
     Tr_level p = checked_malloc(sizeof(*p));
     p->parent = parent;
-    p->frame = F_newFrame(name, U_BoolList(TRUE, formals));
+    p->entry = NULL;
+    p->static_link = static_link;
+    p->captured = captured;
+    p->used = used;
+
+    // Captured variables are passed in registers, each a pointer if its variable is
+    U_boolList all = formals, all_pointers = pointers, *next = &all_pointers;
+    for (Tr_accessList c = captured; c; c = c->tail) {
+        all = U_BoolList(FALSE, all);
+        *next = U_BoolList(F_isPointer(c->head->access), *next);
+        next = &(*next)->tail;
+    }
+    // With a display, outer frames are reached without a static link formal
+    bool link_formal = static_link && F_link == F_staticLinks;
+    if (link_formal) {
+        all = U_BoolList(TRUE, all);
+        all_pointers = U_BoolList(FALSE, all_pointers);
+    }
+    p->frame = F_newFrame(name, all, all_pointers);
+
     p->formals = NULL;
     Tr_accessList tail = NULL;
     for (F_accessList f_formals = F_formals(p->frame); f_formals; f_formals = f_formals->tail) {
@@ -187,18 +336,53 @@ Tr_level Tr_newLevel(Tr_level parent, Temp_label name, U_boolList formals) {
             tail = entry;
         }
     }
+    p->captured_formals = link_formal ? p->formals->tail : p->formals;
     return p;
 }
 
 Tr_accessList Tr_formals(Tr_level level) {
-    return level->formals->tail; // Skip static link
+    Tr_accessList formals = level->captured_formals;
+    for (Tr_accessList c = level->captured; c; c = c->tail) {
+        formals = formals->tail;
+    }
+    return formals;
+}
+
+Tr_access Tr_allocLocal(Tr_level level, bool escape, bool pointer) {
+    return Tr_Access(level, F_allocLocal(level->frame, escape, pointer));
 }
 
-Tr_access Tr_allocLocal(Tr_level level, bool escape) {
-    return Tr_Access(level, F_allocLocal(level->frame, escape));
+// Nesting depth of a level, 0 for the main program
+static int levelDepth(Tr_level level) {
+    int depth = -1;
+    for (; level->parent; level = level->parent) {
+        depth++;
+    }
+    return depth;
 }
 
 Tr_exp Tr_simpleVar(Tr_access access, Tr_level cur_level) {
+    if (cur_level == access->level) {
+        return Tr_Ex(F_exp(access->access, T_Temp(F_FP())));
+    }
+    if (!cur_level->used) {
+        // Never runs, and the enclosing functions may have no static link
+        return Tr_Ex(T_Const(0));
+    }
+
+    // A captured variable is read from the formal it was passed in
+    Tr_accessList f = cur_level->captured_formals;
+    for (Tr_accessList c = cur_level->captured; c; c = c->tail, f = f->tail) {
+        if (c->head == access) {
+            return Tr_Ex(F_exp(f->head->access, T_Temp(F_FP())));
+        }
+    }
+
+    // Otherwise it lives in the frame of an enclosing function
+    assert(cur_level->static_link);
+    if (F_link == F_display) {
+        return Tr_Ex(F_exp(access->access, F_displayEntry(levelDepth(access->level))));
+    }
     T_exp real_fp = T_Temp(F_FP());
     while (cur_level != access->level) {
         T_exp sl = T_Binop(T_plus, real_fp, T_Const(SL_OFFSET));
@@ -224,37 +408,52 @@ Tr_exp Tr_fieldVar(Tr_exp var, int field_idx) {
     );
 }
 
+/*
+ * Literals are interned by Tr_string, so two literals are equal exactly when
+ * their labels are and their order is known here. Other equality tests call
+ * stringEqual, which can tell unequal strings by their lengths or hashes alone;
+ * the orderings take the sign of strCmp.
+ */
 Tr_exp Tr_strCmp(Tr_oper op, Tr_exp l, Tr_exp r) {
-    switch (op) {
-        case Tr_eq: {
-            T_stm stm = T_Cjump(T_eq, F_externalCall("strCmp", T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL))), T_Const(0), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
+    string ls = literalOf(l), rs = literalOf(r);
+    if (ls && rs) {
+        int c = strcmp(ls, rs);
+        switch (op) {
+            case Tr_eq:
+                return Tr_Ex(T_Const(ls == rs));
+            case Tr_neq:
+                return Tr_Ex(T_Const(ls != rs));
+            case Tr_lt:
+                return Tr_Ex(T_Const(c < 0));
+            case Tr_le:
+                return Tr_Ex(T_Const(c <= 0));
+            case Tr_gt:
+                return Tr_Ex(T_Const(c > 0));
+            case Tr_ge:
+                return Tr_Ex(T_Const(c >= 0));
+            default:
+                assert(0);
         }
+    }
+    T_expList args = T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL));
+    switch (op) {
+        case Tr_eq:
+            return relCx(T_ne, F_externalCall("stringEqual", args), T_Const(0));
 
-        case Tr_neq: {
-            T_stm stm = T_Cjump(T_ne, F_externalCall("strCmp", T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL))), T_Const(0), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_neq:
+            return relCx(T_eq, F_externalCall("stringEqual", args), T_Const(0));
 
-        case Tr_lt: {
-            T_stm stm = T_Cjump(T_lt, F_externalCall("strCmp", T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL))), T_Const(0), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_lt:
+            return relCx(T_lt, F_externalCall("strCmp", args), T_Const(0));
 
-        case Tr_le: {
-            T_stm stm = T_Cjump(T_le, F_externalCall("strCmp", T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL))), T_Const(0), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_le:
+            return relCx(T_le, F_externalCall("strCmp", args), T_Const(0));
 
-        case Tr_gt: {
-            T_stm stm = T_Cjump(T_gt, F_externalCall("strCmp", T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL))), T_Const(0), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_gt:
+            return relCx(T_gt, F_externalCall("strCmp", args), T_Const(0));
 
-        case Tr_ge: {
-            T_stm stm = T_Cjump(T_ge, F_externalCall("strCmp", T_ExpList(convertToEx(l), T_ExpList(convertToEx(r), NULL))), T_Const(0), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_ge:
+            return relCx(T_ge, F_externalCall("strCmp", args), T_Const(0));
 
         default:
             assert(0);
@@ -275,35 +474,23 @@ Tr_exp Tr_op(Tr_oper op, Tr_exp l, Tr_exp r) {
         case Tr_divide:
             return Tr_Ex(T_Binop(T_div, convertToEx(l), convertToEx(r)));
 
-        case Tr_eq: {
-            T_stm stm = T_Cjump(T_eq, convertToEx(l), convertToEx(r), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_eq:
+            return relCx(T_eq, convertToEx(l), convertToEx(r));
 
-        case Tr_neq: {
-            T_stm stm = T_Cjump(T_ne, convertToEx(l), convertToEx(r), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_neq:
+            return relCx(T_ne, convertToEx(l), convertToEx(r));
 
-        case Tr_lt: {
-            T_stm stm = T_Cjump(T_lt, convertToEx(l), convertToEx(r), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_lt:
+            return relCx(T_lt, convertToEx(l), convertToEx(r));
 
-        case Tr_le: {
-            T_stm stm = T_Cjump(T_le, convertToEx(l), convertToEx(r), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_le:
+            return relCx(T_le, convertToEx(l), convertToEx(r));
 
-        case Tr_gt: {
-            T_stm stm = T_Cjump(T_gt, convertToEx(l), convertToEx(r), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_gt:
+            return relCx(T_gt, convertToEx(l), convertToEx(r));
 
-        case Tr_ge: {
-            T_stm stm = T_Cjump(T_ge, convertToEx(l), convertToEx(r), NULL, NULL);
-            return Tr_Cx(PatchList(&stm->u.CJUMP.true, NULL), PatchList(&stm->u.CJUMP.false, NULL), stm);
-        }
+        case Tr_ge:
+            return relCx(T_ge, convertToEx(l), convertToEx(r));
 
         default:
             assert(0);
@@ -334,6 +521,17 @@ Tr_exp Tr_ifthenelse(Tr_exp test, Tr_exp then, Tr_exp elsee) {
     // for example: if a then p < q else 0
     if ((then->kind == Tr_cx && (elsee->kind == Tr_cx || (elsee->kind == Tr_ex && elsee->u.ex->kind == T_CONST && (elsee->u.ex->u.CONST == 0 || elsee->u.ex->u.CONST == 1))))
     ||  (elsee->kind == Tr_cx && (then->kind == Tr_cx || (then->kind == Tr_ex && then->u.ex->kind == T_CONST && (then->u.ex->u.CONST == 0 || then->u.ex->u.CONST == 1))))) {
+        // a & b and a | b, as "and" and "or" of their values if b is cheap
+        T_exp value = NULL, a = boolValue(test);
+        int budget = CHEAP_NODES;
+        if (a && then->kind == Tr_cx && then->u.cx.value && elsee->kind == Tr_ex && elsee->u.ex->u.CONST == 0
+            && isCheap(then->u.cx.value, &budget)) {
+            value = T_Binop(T_and, a, then->u.cx.value);
+        } else if (a && elsee->kind == Tr_cx && elsee->u.cx.value && then->kind == Tr_ex && then->u.ex->u.CONST == 1
+                   && isCheap(elsee->u.cx.value, &budget)) {
+            value = T_Binop(T_or, a, elsee->u.cx.value);
+        }
+
         Cx then_c = convertToCx(then), elses_c = convertToCx(elsee);
         Temp_label t = Temp_newlabel(), f = Temp_newlabel(), conj = Temp_newlabel();
         doPatch(cx.trues, t);
@@ -346,9 +544,11 @@ Tr_exp Tr_ifthenelse(Tr_exp test, Tr_exp then, Tr_exp elsee) {
                                                   T_Seq(elses_c.stm,
                                                         T_Label(conj)))))));
 
-        return Tr_Cx(joinPatch(then_c.trues, elses_c.trues),
-                     joinPatch(then_c.falses, elses_c.falses),
-                     stm);
+        Tr_exp p = Tr_Cx(joinPatch(then_c.trues, elses_c.trues),
+                         joinPatch(then_c.falses, elses_c.falses),
+                         stm);
+        p->u.cx.value = value;
+        return p;
     }
 
     // Condition4: nx+ex
@@ -385,74 +585,235 @@ Tr_exp Tr_ifthen(Tr_exp test, Tr_exp then) {
     return Tr_Nx(T_Seq(cx.stm, T_Seq(T_Label(t), T_Seq(convertToNx(then), T_Label(f)))));
 }
 
-Tr_exp Tr_newRecord(int n_field, Tr_expList initializers) {
-    Temp_temp r = Temp_newtemp();
-    T_stm alloca = T_Move(T_Temp(r),
-                          F_externalCall("malloc",
-                                         T_ExpList(T_Const(n_field * F_wordSize), NULL)
-                          ));
-    Temp_temp p = Temp_newtemp();
-    T_stm init = T_Move(T_Temp(p), T_Temp(r));
-    T_stm seq, seq_tail;
-    seq = seq_tail = T_Seq(T_Seq(alloca, init), NULL);
+/*
+ * Allocation
+ *
+ * Objects are bumped in line from the runtime's allocation pointer hp up to the end
+ * of its current page hlimit, and only got from the runtime when the page is full.
+ * The header laid out here must match the one of chap12/runtime.c: the layout of a
+ * record (or 0), then the size in words shifted left by 2, or'ed with the kind.
+ */
+
+#define OBJ_HEADER 2
+enum {OBJ_RECORD, OBJ_POINTERS, OBJ_DATA};
+
+// Longest array of a constant size allocated in line; the fill of a longer one outweighs the call
+#define INLINE_ARRAY 16
+
+void Tr_profileAllocations(bool enable) {
+    profile = enable;
+}
+
+// args of an allocation call, followed by the site of pos as line << 12 | column when profiling
+static T_expList allocArgs(T_expList args, int pos) {
+    if (!profile) {
+        return args;
+    }
+    int line, col;
+    EM_position(pos, &line, &col);
+    T_expList site = T_ExpList(T_Const(line << 12 | (col < 4096 ? col : 4095)), NULL);
+    if (!args) {
+        return site;
+    }
+    T_expList last = args;
+    while (last->tail) {
+        last = last->tail;
+    }
+    last->tail = site;
+    return args;
+}
+
+/*
+ * r = a new object of words words, with the fields left as they are on the fast
+ * path; slow is the runtime call that allocates it otherwise.
+ */
+static T_stm bumpAlloc(Temp_temp r, int words, int kind, T_exp layout, T_exp slow) {
+    Temp_temp p = Temp_newtemp(), q = Temp_newtemp();
+    Temp_label fast_l = Temp_newlabel(), slow_l = Temp_newlabel(), join = Temp_newlabel();
+    int bytes = (words + OBJ_HEADER) * F_wordSize;
+    T_stm bump = T_Seq(T_Move(T_Temp(p), T_Mem(T_Name(Temp_namedlabel("hp")))),
+                       T_Seq(T_Move(T_Temp(q), T_Binop(T_plus, T_Temp(p), T_Const(bytes))),
+                             T_Cjump(T_ugt, T_Temp(q), T_Mem(T_Name(Temp_namedlabel("hlimit"))), slow_l, fast_l)));
+    T_stm fast = T_Seq(T_Label(fast_l),
+                       T_Seq(T_Move(T_Mem(T_Name(Temp_namedlabel("hp"))), T_Temp(q)),
+                             T_Seq(T_Move(T_Mem(T_Temp(p)), layout),
+                                   T_Seq(T_Move(T_Mem(T_Binop(T_plus, T_Temp(p), T_Const(F_wordSize))),
+                                                T_Const(words << 2 | kind)),
+                                         T_Seq(T_Move(T_Temp(r), T_Binop(T_plus, T_Temp(p),
+                                                                         T_Const(OBJ_HEADER * F_wordSize))),
+                                               T_Jump(T_Name(join), Temp_LabelList(join, NULL)))))));
+    T_stm slow_path = T_Seq(T_Label(slow_l), T_Seq(T_Move(T_Temp(r), slow), T_Label(join)));
+    return T_Seq(bump, T_Seq(fast, slow_path));
+}
+
+/*
+ * Store values[0..n) at constant offsets from r, once it is allocated. A value with
+ * effects might collect before the stores, while the fields are not yet initialized,
+ * so then all of them are computed into temps first, in order, by *eval.
+ */
+static T_stm storeFields(Temp_temp r, T_exp *values, int n, T_stm *eval) {
+    bool effects = FALSE;
+    for (int i = 0; i < n; i++) {
+        effects = effects || hasEffects(values[i]);
+    }
+    *eval = NULL;
+    for (int i = 0; effects && i < n; i++) {
+        if (values[i]->kind != T_CONST) {
+            Temp_temp t = Temp_newtemp();
+            t->pointer = T_isPointer(values[i]);
+            T_stm move = T_Move(T_Temp(t), values[i]);
+            *eval = *eval ? T_Seq(*eval, move) : move;
+            values[i] = T_Temp(t);
+        }
+    }
+    T_stm stores = T_Exp(T_Const(0));
+    for (int i = n - 1; i >= 0; i--) {
+        stores = T_Seq(T_Move(T_Mem(T_Binop(T_plus, T_Temp(r), T_Const(i * F_wordSize))), values[i]), stores);
+    }
+    return stores;
+}
+
+Tr_exp Tr_newRecord(int n_field, Tr_expList initializers, string layout, int pos) {
+    T_exp *values = checked_malloc((n_field + 1) * sizeof(T_exp));
     Tr_expList cur = initializers;
     for (int i = 0; i < n_field; i++) {
         assert(cur);
-
-        T_stm field_init = T_Move(T_Mem(T_Temp(p)), convertToEx(cur->head));
-        seq_tail->u.SEQ.right = T_Seq(
-                T_Seq(field_init, T_Move(T_Temp(p), T_Binop(T_plus, T_Temp(p), T_Const(F_wordSize)))), NULL);
-        seq_tail = seq_tail->u.SEQ.right;
-
+        values[i] = convertToEx(cur->head);
         cur = cur->tail;
     }
-    seq_tail->u.SEQ.right = convertToNx(Tr_nop());
     assert(!cur);
-    return Tr_Ex(T_Eseq(seq, T_Temp(r)));
-}
-
-Tr_exp Tr_newArray(Tr_exp n, Tr_exp initializer) {
-    Temp_temp size_e = Temp_newtemp();
-    T_stm calc_size = T_Move(T_Temp(size_e), T_Binop(T_mul, convertToEx(n), T_Const(F_wordSize)));
 
     Temp_temp r = Temp_newtemp();
-    T_stm alloca = T_Move(T_Temp(r),
-                          F_externalCall("malloc",
-                                         T_ExpList(T_Temp(size_e), NULL)
-                          ));
-    T_exp init = F_externalCall("initArray", T_ExpList(T_Temp(r), T_ExpList(T_Temp(size_e), NULL)));
+    r->pointer = TRUE;
+    Temp_label l = convertToEx(Tr_string(layout))->u.NAME;
+    T_stm eval;
+    T_stm stores = storeFields(r, values, n_field, &eval);
+    T_exp call = F_externalCall("allocRecord", allocArgs(T_ExpList(T_Const(n_field * F_wordSize),
+                                                                   T_ExpList(T_Name(l), NULL)), pos));
+    T_stm alloc = profile ? T_Move(T_Temp(r), call) : bumpAlloc(r, n_field, OBJ_RECORD, T_Name(l), call);
+    T_stm s = T_Seq(alloc, stores);
+    return Tr_Ex(T_Eseq(eval ? T_Seq(eval, s) : s, T_Temp(r)));
+}
+
+Tr_exp Tr_newArray(Tr_exp n, Tr_exp initializer, bool pointers, int pos) {
+    T_exp size = convertToEx(n), init = convertToEx(initializer);
+    if (profile || size->kind != T_CONST || size->u.CONST < 0 || size->u.CONST > INLINE_ARRAY) {
+        return Tr_Ex(F_externalCall("initArray", allocArgs(T_ExpList(size, T_ExpList(init, T_ExpList(T_Const(pointers),
+                                                                                                      NULL))), pos)));
+    }
+
+    // The initializer is computed once, before the allocation, unless it is the zero register
+    T_stm eval = NULL;
+    if (init->kind != T_CONST || init->u.CONST != 0) {
+        Temp_temp t = Temp_newtemp();
+        t->pointer = pointers;
+        eval = T_Move(T_Temp(t), init);
+        init = T_Temp(t);
+    }
+    int words = size->u.CONST;
+    T_exp *values = checked_malloc((words + 1) * sizeof(T_exp));
+    for (int i = 0; i < words; i++) {
+        values[i] = init->kind == T_CONST ? T_Const(init->u.CONST) : T_Temp(init->u.TEMP);
+    }
 
-    return Tr_Ex(T_Eseq(T_Seq(calc_size, T_Seq(alloca, T_Exp(init))), T_Temp(r)));
+    Temp_temp r = Temp_newtemp();
+    r->pointer = TRUE;
+    T_stm no_eval;
+    T_stm stores = storeFields(r, values, words, &no_eval);
+    T_exp slow_init = init->kind == T_CONST ? T_Const(init->u.CONST) : T_Temp(init->u.TEMP);
+    T_stm alloc = bumpAlloc(r, words, pointers ? OBJ_POINTERS : OBJ_DATA, T_Const(0),
+                            F_externalCall("initArray", T_ExpList(T_Const(words),
+                                                                  T_ExpList(slow_init,
+                                                                            T_ExpList(T_Const(pointers), NULL)))));
+    T_stm s = T_Seq(alloc, stores);
+    return Tr_Ex(T_Eseq(eval ? T_Seq(eval, s) : s, T_Temp(r)));
 }
 
+/*
+ * Loops are tested at the bottom, behind a copy of the test guarding the entry,
+ * so that an iteration takes one branch:
+ *
+ *     if test goto body else done
+ *   body:
+ *     body
+ *     if test goto body else done
+ *   done:
+ */
 Tr_exp Tr_while(Tr_exp test, Tr_exp body, Temp_label done) {
-    Temp_label test_lbl = Temp_newlabel();
-    Temp_label continue_lbl = Temp_newlabel();
+    Temp_label body_lbl = Temp_newlabel();
     Cx test_cx = convertToCx(test);
-    doPatch(test_cx.trues, continue_lbl);
+    doPatch(test_cx.trues, body_lbl);
     doPatch(test_cx.falses, done);
-    return Tr_Nx(T_Seq(T_Label(test_lbl),
-                       T_Seq(test_cx.stm,
-                             T_Seq(T_Label(continue_lbl),
-                                   T_Seq(convertToNx(body),
-                                         T_Seq(T_Jump(T_Name(test_lbl), Temp_LabelList(test_lbl, NULL)),
-                                               T_Label(done)))))));
+    return Tr_Nx(T_Seq(test_cx.stm,
+                       T_Seq(T_Label(body_lbl),
+                             T_Seq(convertToNx(body),
+                                   T_Seq(T_copyStm(test_cx.stm),
+                                         T_Label(done))))));
+}
+
+/*
+ * The bounds are evaluated once, the upper one into a temp. The variable is
+ * compared with the bound before it is incremented, so that it cannot overflow:
+ *
+ *     i := lo; limit := hi
+ *     if i <= limit goto body else done
+ *   inc:
+ *     i := i + 1
+ *   body:
+ *     body
+ *     if i < limit goto inc else done
+ *   done:
+ *
+ * The increment falls into the body, so an iteration takes a single branch.
+ */
+// A fresh tree for every use of the loop variable, as canon rewrites trees in place
+static T_exp loopVar(Tr_access var, Tr_level level) {
+    return convertToEx(Tr_simpleVar(var, level));
 }
 
 Tr_exp Tr_for(Tr_access var, Tr_level cur_level, Tr_exp lo, Tr_exp hi, Tr_exp body, Temp_label done) {
-    Temp_label for_loop = Temp_newlabel();
-    Temp_label enter_lbl = Temp_newlabel();
-    T_exp loop_var = convertToEx(Tr_simpleVar(var, cur_level));
-    return Tr_Nx(T_Seq(T_Label(for_loop),
-                       T_Seq(T_Move(loop_var, convertToEx(lo)),
-                             T_Seq(T_Cjump(T_le, loop_var, convertToEx(hi), enter_lbl, done),
-                                   T_Seq(T_Label(enter_lbl),
-                                         T_Seq(convertToNx(body),
-                                               T_Seq(T_Jump(T_Name(enter_lbl), Temp_LabelList(enter_lbl, NULL)),
-                                                     T_Label(done))))))));
-}
-
-Tr_exp Tr_functionCall(S_symbol name, Tr_level callee, Tr_level caller, Tr_expList args, bool is_proc) {
+    Temp_label body_lbl = Temp_newlabel();
+    Temp_label inc_lbl = Temp_newlabel();
+    T_exp limit = T_Temp(Temp_newtemp());
+    T_stm stm = T_Seq(T_Move(loopVar(var, cur_level), convertToEx(lo)),
+                      T_Seq(T_Move(limit, convertToEx(hi)),
+                            T_Seq(T_Cjump(T_le, loopVar(var, cur_level), T_Temp(limit->u.TEMP), body_lbl, done),
+                                  T_Seq(T_Label(inc_lbl),
+                                        T_Seq(T_Move(loopVar(var, cur_level), T_Binop(T_plus, loopVar(var, cur_level), T_Const(1))),
+                                              T_Seq(T_Label(body_lbl),
+                                                    T_Seq(convertToNx(body),
+                                                          T_Seq(T_Cjump(T_lt, loopVar(var, cur_level), T_Temp(limit->u.TEMP), inc_lbl, done),
+                                                                T_Label(done)))))))));
+    return Tr_Nx(stm);
+}
+
+/*
+ * A self-recursive tail call becomes a jump back to the entry of the function:
+ * evaluate all arguments first (they may read the formals), then overwrite the formals.
+ */
+static Tr_exp selfTailCall(Tr_level level, T_expList args, bool is_proc) {
+    T_stm eval = NULL, assign = NULL;
+    Tr_accessList formals = Tr_formals(level);
+    for (; args; args = args->tail, formals = formals->tail) {
+        assert(formals);
+        Temp_temp t = Temp_newtemp();
+        t->pointer = T_isPointer(args->head);
+        T_stm e = T_Move(T_Temp(t), args->head);
+        T_stm a = T_Move(F_exp(formals->head->access, T_Temp(F_FP())), T_Temp(t));
+        eval = eval ? T_Seq(eval, e) : e;
+        assign = assign ? T_Seq(assign, a) : a;
+    }
+    assert(!formals);
+
+    if (!level->entry) {
+        level->entry = Temp_newlabel();
+    }
+    T_stm jump = T_Jump(T_Name(level->entry), Temp_LabelList(level->entry, NULL));
+    T_stm stm = eval ? T_Seq(eval, T_Seq(assign, jump)) : jump;
+    return is_proc ? Tr_Nx(stm) : Tr_Ex(T_Eseq(stm, T_Const(0)));
+}
+
+Tr_exp Tr_functionCall(S_symbol name, Tr_level callee, Tr_level caller, Tr_expList args, bool is_proc, bool is_tail) {
     Tr_level p;
 
     // args
@@ -475,37 +836,65 @@ Tr_exp Tr_functionCall(S_symbol name, Tr_level callee, Tr_level caller, Tr_expLi
         return !is_proc ? Tr_Ex(c) : Tr_Nx(T_Exp(c));
     }
 
-    // calculate static link first
-    int callee_depth = 0, caller_depth = 0;
-    p = callee;
-    while (p) {
-        callee_depth++;
-        p = p->parent;
-    }
-    p = caller;
-    while (p) {
-        caller_depth++;
-        p = p->parent;
+    if (is_tail && callee == caller) {
+        return selfTailCall(callee, converted_args, is_proc);
     }
 
-    T_exp sl = T_Temp(F_FP());
+    // Captured outer variables are passed before the declared arguments
+    T_expList all_args = converted_args, captured_tail = NULL;
+    for (Tr_accessList c = callee->captured; c; c = c->tail) {
+        T_expList node = T_ExpList(convertToEx(Tr_simpleVar(c->head, caller)), converted_args);
+        node->head->pointer = F_isPointer(c->head->access);
+        if (!captured_tail) {
+            all_args = captured_tail = node;
+        } else {
+            captured_tail->tail = node;
+            captured_tail = node;
+        }
+    }
 
-    /*
-     * To calculate the FP of the parent level of callee
-     *
-     * 1. fun C() { fun callee() { ... fun caller() { callee() } ... } } -- callee_depth < caller_depth
-     * 2. fun C() { fun callee(); fun caller() { callee() } } -- callee_depth = caller_depth
-     * 3. fun C() { fun caller() { fun callee() {} callee() } } -- callee_depth = caller_depth + 1
-     *
-     * so, callee_depth <= caller_depth + 1
-     */
-    assert(callee_depth <= caller_depth + 1);
+    if (callee->static_link && F_link == F_staticLinks) {
+        // calculate static link first
+        int callee_depth = 0, caller_depth = 0;
+        p = callee;
+        while (p) {
+            callee_depth++;
+            p = p->parent;
+        }
+        p = caller;
+        while (p) {
+            caller_depth++;
+            p = p->parent;
+        }
 
-    for (int i = 0; i < caller_depth - callee_depth + 1; i++) {
-        sl = T_Mem(T_Binop(T_plus, sl, T_Const(SL_OFFSET)));
+        T_exp sl = T_Temp(F_FP());
+
+        /*
+         * To calculate the FP of the parent level of callee
+         *
+         * 1. fun C() { fun callee() { ... fun caller() { callee() } ... } } -- callee_depth < caller_depth
+         * 2. fun C() { fun callee(); fun caller() { callee() } } -- callee_depth = caller_depth
+         * 3. fun C() { fun caller() { fun callee() {} callee() } } -- callee_depth = caller_depth + 1
+         *
+         * so, callee_depth <= caller_depth + 1
+         */
+        assert(callee_depth <= caller_depth + 1);
+
+        for (int i = 0; i < caller_depth - callee_depth + 1; i++) {
+            sl = T_Mem(T_Binop(T_plus, sl, T_Const(SL_OFFSET)));
+        }
+        all_args = T_ExpList(sl, all_args);
     }
 
-    T_exp call = T_Call(T_Name(F_name(callee->frame)), T_ExpList(sl, converted_args));
+    /*
+     * A sibling call in tail position can reuse the frame of the caller, unless the callee
+     * is nested in the caller and its static link points into that frame. With a display
+     * the caller might have to restore its display slot on exit, so it never does.
+     */
+    T_exp call = is_tail && F_link == F_staticLinks && (callee->parent != caller || !callee->static_link)
+                 && F_frameFits(caller->frame, callee->frame)
+                 ? T_TailCall(T_Name(F_name(callee->frame)), all_args)
+                 : T_Call(T_Name(F_name(callee->frame)), all_args);
     return !is_proc ? Tr_Ex(call) : Tr_Nx(T_Exp(call));
 }
 
@@ -521,9 +910,23 @@ Tr_exp Tr_nop() {
     return Tr_Nx(T_Exp(T_Const(0)));
 }
 
+/*
+ * One fragment per distinct literal: the symbol of its text names it, and the
+ * label gives back the interned text
+ */
 Tr_exp Tr_string(string s) {
-    Temp_label label = Temp_newlabel();
-    insertFrag(F_StringFrag(label, s));
+    if (!literals) {
+        literals = S_empty();
+        literal_text = TAB_empty();
+    }
+    S_symbol key = S_Symbol(s);
+    Temp_label label = S_look(literals, key);
+    if (!label) {
+        label = Temp_newlabel();
+        S_enter(literals, key, label);
+        TAB_enter(literal_text, label, S_name(key));
+        insertFrag(F_StringFrag(label, s));
+    }
     return Tr_Ex(T_Name(label));
 }
 
@@ -539,10 +942,45 @@ Tr_exp Tr_stmtSeq(Tr_exp left, Tr_exp right) {
     return Tr_Nx(T_Seq(convertToNx(left), convertToNx(right)));
 }
 
+void Tr_markPointer(Tr_exp exp) {
+    if (exp->kind != Tr_ex) {
+        return;
+    }
+    // Canon hoists the statements of an ESEQ and goes on with its expression
+    T_exp e = exp->u.ex;
+    for (; e->kind == T_ESEQ; e = e->u.ESEQ.exp) {
+        e->pointer = TRUE;
+    }
+    e->pointer = TRUE;
+    if (e->kind == T_TEMP) {
+        e->u.TEMP->pointer = TRUE;
+    }
+}
+
 F_fragList Tr_getResult() {
     return frags;
 }
 
 void Tr_procEntryExit(Tr_level level, Tr_exp body, Tr_accessList formals) {
-    insertFrag(F_ProcFrag(T_Move(T_Temp(F_RV()), convertToEx(body)), level->frame));
+    if (!level->used) {
+        return;
+    }
+    T_exp ex = convertToEx(body);
+    if (level->entry) {
+        ex = T_Eseq(T_Label(level->entry), ex);
+    }
+    T_stm clear = F_clearPointers(level->frame);
+    if (clear) {
+        ex = T_Eseq(clear, ex);
+    }
+    if (F_link == F_display && F_hasEscaping(level->frame)) {
+        // Publish the frame in the display while the body runs
+        int depth = levelDepth(level);
+        Temp_temp saved = Temp_newtemp(), r = Temp_newtemp();
+        T_stm enter = T_Seq(T_Move(T_Temp(saved), F_displayEntry(depth)),
+                            T_Move(F_displayEntry(depth), T_Temp(F_FP())));
+        T_stm leave = T_Move(F_displayEntry(depth), T_Temp(saved));
+        ex = T_Eseq(enter, T_Eseq(T_Move(T_Temp(r), ex), T_Eseq(leave, T_Temp(r))));
+    }
+    insertFrag(F_ProcFrag(T_Move(T_Temp(F_RV()), ex), level->frame));
 }
@@ -8,6 +8,9 @@
 #include "temp.h"
 #include "frame.h"
 
+// Offset of the static link from the frame pointer
+#define SL_OFFSET (-4)
+
 typedef struct Tr_access_ *Tr_access;
 typedef struct Tr_accessList_ *Tr_accessList;
 typedef struct Tr_level_ *Tr_level;
@@ -16,6 +19,11 @@ struct Tr_level_ {
     Tr_level parent;
     F_frame frame;
     Tr_accessList formals;
+    Temp_label entry;   // Target of self-recursive tail calls, NULL if there is none
+    bool static_link;   // FALSE if the function is lifted out of its parent
+    Tr_accessList captured;         // Outer variables passed as extra arguments
+    Tr_accessList captured_formals; // The formals receiving them
+    bool used;          // FALSE if the function is never called, so no code is emitted for it
 };
 
 struct Tr_access_ {
@@ -32,11 +40,23 @@ Tr_accessList Tr_AccessList(Tr_access head, Tr_accessList tail);
 
 Tr_level Tr_outermost(void);
 
-Tr_level Tr_newLevel(Tr_level parent, Temp_label name, U_boolList formals);
+/*
+ * Formals of the frame are the static link (if any), then the captured outer
+ * variables, then the declared formals. pointers tells which declared formals
+ * hold heap pointers.
+ */
+Tr_level Tr_newLevel(Tr_level parent, Temp_label name, U_boolList formals, U_boolList pointers, bool static_link,
+                     Tr_accessList captured, bool used);
 
 Tr_accessList Tr_formals(Tr_level level);
 
-Tr_access Tr_allocLocal(Tr_level level, bool escape);
+// Remember the source name of the function of the given label, for reports
+void Tr_nameFunction(Temp_label label, S_symbol name);
+
+// "name (label)" for a function named by Tr_nameFunction, the label alone otherwise
+string Tr_functionName(Temp_label label);
+
+Tr_access Tr_allocLocal(Tr_level level, bool escape, bool pointer);
 
 typedef struct Tr_exp_ *Tr_exp;
 typedef struct Tr_expList_ *Tr_expList;
@@ -54,6 +74,7 @@ typedef struct Cx_ Cx;
 struct Cx_ {
     patchList trues, falses;
     T_stm stm;
+    T_exp value;    // The condition as 1 or 0 computed without branches instead of stm, or NULL
 };
 
 struct patchList_ {
@@ -80,15 +101,23 @@ struct Tr_expList_ {
 
 Tr_exp Tr_assign(Tr_exp lhs, Tr_exp rhs);
 
-Tr_exp Tr_functionCall(S_symbol name, Tr_level callee, Tr_level caller, Tr_expList args, bool is_proc);
+Tr_exp Tr_functionCall(S_symbol name, Tr_level callee, Tr_level caller, Tr_expList args, bool is_proc, bool is_tail);
 
 Tr_exp Tr_for(Tr_access var, Tr_level cur_level, Tr_exp lo, Tr_exp hi, Tr_exp body, Temp_label done);
 
 Tr_exp Tr_while(Tr_exp test, Tr_exp body, Temp_label done);
 
-Tr_exp Tr_newArray(Tr_exp n, Tr_exp initializer);
+// Heap objects tell the collector which of their words are pointers; pos is the source position of the allocation
+Tr_exp Tr_newArray(Tr_exp n, Tr_exp initializer, bool pointers, int pos);
 
-Tr_exp Tr_newRecord(int n_field, Tr_expList initializers);
+// layout holds 'p' for each field that is a pointer and 'i' for the others
+Tr_exp Tr_newRecord(int n_field, Tr_expList initializers, string layout, int pos);
+
+/*
+ * Allocate every record and array by a runtime call that is passed the source
+ * line and column of its allocation, for a runtime built with TIGER_PROFILE
+ */
+void Tr_profileAllocations(bool enable);
 
 Tr_exp Tr_ifthen(Tr_exp test, Tr_exp then);
 
@@ -116,6 +145,9 @@ Tr_exp Tr_stmtSeq(Tr_exp left, Tr_exp right);
 
 Tr_exp Tr_seq(Tr_exp stm, Tr_exp res);
 
+// Note that the value of exp is a heap pointer, so the temps that hold it are in the stack maps
+void Tr_markPointer(Tr_exp exp);
+
 void Tr_procEntryExit(Tr_level level, Tr_exp body, Tr_accessList formals);
 
 F_fragList Tr_getResult();
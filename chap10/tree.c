@@ -71,6 +71,7 @@ T_stm T_Exp(T_exp exp) {
 T_exp T_Binop(T_binOp op, T_exp left, T_exp right) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_BINOP;
+    p->pointer = FALSE;
     p->u.BINOP.op = op;
     p->u.BINOP.left = left;
     p->u.BINOP.right = right;
@@ -80,6 +81,7 @@ T_exp T_Binop(T_binOp op, T_exp left, T_exp right) {
 T_exp T_Mem(T_exp exp) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_MEM;
+    p->pointer = FALSE;
     p->u.MEM = exp;
     return p;
 }
@@ -87,6 +89,7 @@ T_exp T_Mem(T_exp exp) {
 T_exp T_Temp(Temp_temp temp) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_TEMP;
+    p->pointer = FALSE;
     p->u.TEMP = temp;
     return p;
 }
@@ -94,6 +97,7 @@ T_exp T_Temp(Temp_temp temp) {
 T_exp T_Eseq(T_stm stm, T_exp exp) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_ESEQ;
+    p->pointer = FALSE;
     p->u.ESEQ.stm = stm;
     p->u.ESEQ.exp = exp;
     return p;
@@ -102,6 +106,7 @@ T_exp T_Eseq(T_stm stm, T_exp exp) {
 T_exp T_Name(Temp_label name) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_NAME;
+    p->pointer = FALSE;
     p->u.NAME = name;
     return p;
 }
@@ -109,6 +114,7 @@ T_exp T_Name(Temp_label name) {
 T_exp T_Const(int consti) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_CONST;
+    p->pointer = FALSE;
     p->u.CONST = consti;
     return p;
 }
@@ -116,11 +122,23 @@ T_exp T_Const(int consti) {
 T_exp T_Call(T_exp fun, T_expList args) {
     T_exp p = (T_exp) checked_malloc(sizeof *p);
     p->kind = T_CALL;
+    p->pointer = FALSE;
     p->u.CALL.fun = fun;
     p->u.CALL.args = args;
+    p->u.CALL.tail = FALSE;
     return p;
 }
 
+T_exp T_TailCall(T_exp fun, T_expList args) {
+    T_exp p = T_Call(fun, args);
+    p->u.CALL.tail = TRUE;
+    return p;
+}
+
+bool T_isPointer(T_exp exp) {
+    return exp->pointer || (exp->kind == T_TEMP && exp->u.TEMP->pointer);
+}
+
 T_relOp T_notRel(T_relOp r) {
     switch (r) {
         case T_eq:
@@ -176,3 +194,146 @@ T_relOp T_commute(T_relOp r) {
 }
 
 
+
+/*
+ * Copying
+ */
+
+static S_table copy_labels; // Map a label defined in the tree being copied to its copy
+
+static void defineLabels(T_stm stm);
+
+static void defineLabelsExp(T_exp exp) {
+    switch (exp->kind) {
+        case T_BINOP:
+            defineLabelsExp(exp->u.BINOP.left);
+            defineLabelsExp(exp->u.BINOP.right);
+            break;
+        case T_MEM:
+            defineLabelsExp(exp->u.MEM);
+            break;
+        case T_ESEQ:
+            defineLabels(exp->u.ESEQ.stm);
+            defineLabelsExp(exp->u.ESEQ.exp);
+            break;
+        case T_CALL:
+            defineLabelsExp(exp->u.CALL.fun);
+            for (T_expList l = exp->u.CALL.args; l; l = l->tail) {
+                defineLabelsExp(l->head);
+            }
+            break;
+        default: ;
+    }
+}
+
+static void defineLabels(T_stm stm) {
+    switch (stm->kind) {
+        case T_SEQ:
+            defineLabels(stm->u.SEQ.left);
+            defineLabels(stm->u.SEQ.right);
+            break;
+        case T_LABEL:
+            S_enter(copy_labels, stm->u.LABEL, Temp_newlabel());
+            break;
+        case T_JUMP:
+            defineLabelsExp(stm->u.JUMP.exp);
+            break;
+        case T_CJUMP:
+            defineLabelsExp(stm->u.CJUMP.left);
+            defineLabelsExp(stm->u.CJUMP.right);
+            break;
+        case T_MOVE:
+            defineLabelsExp(stm->u.MOVE.dst);
+            defineLabelsExp(stm->u.MOVE.src);
+            break;
+        case T_EXP:
+            defineLabelsExp(stm->u.EXP);
+            break;
+    }
+}
+
+static Temp_label copyLabel(Temp_label label) {
+    Temp_label l = S_look(copy_labels, label);
+    return l ? l : label;
+}
+
+static T_stm copyStm(T_stm stm);
+
+static T_exp copyExp(T_exp exp);
+
+static T_exp copyNode(T_exp exp) {
+    switch (exp->kind) {
+        case T_BINOP:
+            return T_Binop(exp->u.BINOP.op, copyExp(exp->u.BINOP.left), copyExp(exp->u.BINOP.right));
+        case T_MEM:
+            return T_Mem(copyExp(exp->u.MEM));
+        case T_TEMP:
+            return T_Temp(exp->u.TEMP);
+        case T_ESEQ:
+            return T_Eseq(copyStm(exp->u.ESEQ.stm), copyExp(exp->u.ESEQ.exp));
+        case T_NAME:
+            return T_Name(copyLabel(exp->u.NAME));
+        case T_CONST:
+            return T_Const(exp->u.CONST);
+        case T_CALL: {
+            T_expList args = NULL, tail = NULL;
+            for (T_expList l = exp->u.CALL.args; l; l = l->tail) {
+                T_expList node = T_ExpList(copyExp(l->head), NULL);
+                if (!args) {
+                    args = tail = node;
+                } else {
+                    tail->tail = node;
+                    tail = node;
+                }
+            }
+            T_exp call = T_Call(copyExp(exp->u.CALL.fun), args);
+            call->u.CALL.tail = exp->u.CALL.tail;
+            return call;
+        }
+    }
+    assert(0);
+    return NULL;
+}
+
+static T_exp copyExp(T_exp exp) {
+    T_exp copy = copyNode(exp);
+    copy->pointer = exp->pointer;
+    return copy;
+}
+
+static T_stm copyStm(T_stm stm) {
+    switch (stm->kind) {
+        case T_SEQ:
+            return T_Seq(copyStm(stm->u.SEQ.left), copyStm(stm->u.SEQ.right));
+        case T_LABEL:
+            return T_Label(copyLabel(stm->u.LABEL));
+        case T_JUMP: {
+            Temp_labelList jumps = NULL, tail = NULL;
+            for (Temp_labelList l = stm->u.JUMP.jumps; l; l = l->tail) {
+                Temp_labelList node = Temp_LabelList(copyLabel(l->head), NULL);
+                if (!jumps) {
+                    jumps = tail = node;
+                } else {
+                    tail->tail = node;
+                    tail = node;
+                }
+            }
+            return T_Jump(copyExp(stm->u.JUMP.exp), jumps);
+        }
+        case T_CJUMP:
+            return T_Cjump(stm->u.CJUMP.op, copyExp(stm->u.CJUMP.left), copyExp(stm->u.CJUMP.right),
+                           copyLabel(stm->u.CJUMP.true), copyLabel(stm->u.CJUMP.false));
+        case T_MOVE:
+            return T_Move(copyExp(stm->u.MOVE.dst), copyExp(stm->u.MOVE.src));
+        case T_EXP:
+            return T_Exp(copyExp(stm->u.EXP));
+    }
+    assert(0);
+    return NULL;
+}
+
+T_stm T_copyStm(T_stm stm) {
+    copy_labels = S_empty();
+    defineLabels(stm);
+    return copyStm(stm);
+}
@@ -23,7 +23,8 @@ struct T_stmList_ {
 
 typedef enum {
     T_plus, T_minus, T_mul, T_div,
-    T_and, T_or, T_lshift, T_rshift, T_arshift, T_xor
+    T_and, T_or, T_lshift, T_rshift, T_arshift, T_xor,
+    T_slt, T_sltu   /* 1 if left < right as signed or unsigned numbers, else 0 */
 } T_binOp;
 
 typedef enum {
@@ -80,8 +81,10 @@ struct T_exp_ {
         struct {
             T_exp fun;
             T_expList args;
+            bool tail;  // Sibling call in tail position, reusing the caller's frame
         } CALL;
     } u;
+    bool pointer;   // The value is a heap pointer, which canon keeps in pointer temps
     int cost;
     int selection;
 };
@@ -117,6 +120,14 @@ T_exp T_Const(int);
 
 T_exp T_Call(T_exp, T_expList);
 
+T_exp T_TailCall(T_exp, T_expList);
+
+/* Whether exp evaluates to a heap pointer: marked so, or a temp holding one */
+bool T_isPointer(T_exp exp);
+
+/* A copy of stm sharing its temps, where the labels defined inside stm are renamed */
+T_stm T_copyStm(T_stm stm);
+
 T_relOp T_notRel(T_relOp);  /* a op b    ==     not(a notRel(op) b)  */
 T_relOp T_commute(T_relOp); /* a op b    ==    b commute(op) a       */
 
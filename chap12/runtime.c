@@ -1,99 +1,769 @@
+#ifndef TIGER_HOST /* defined by tests/gctest.c, which builds the runtime against glibc */
 #undef __STDC__
+#endif
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
 
+/*
+ * Heap
+ *
+ * Records, arrays and strings live in a heap of pages collected by mostly-copying
+ * collection (Bartlett). Objects are allocated by bumping hp up to hlimit, the end
+ * of the current page; an object larger than a page gets a run of pages of its own.
+ * Compiled code bumps hp itself for records and small arrays, and calls allocRecord
+ * or initArray only when the page is full, so the header layout below is shared
+ * with translate.c.
+ *
+ * The heap comes zeroed from calloc, which maps fresh pages from the system for a
+ * heap this large, so objects need no clearing until their pages are reused.
+ *
+ * Words on the stack and in the registers may or may not be pointers, since frames
+ * have no pointer maps: a collection first promotes every page such a word points
+ * into to the new space, leaving its objects in place. Then, from the promoted
+ * pages on, reachable objects are copied to new pages of the new space and scanned,
+ * Cheney style; the objects know which of their words are pointers.
+ *
+ * An object is preceded by a two-word header:
+ *   obj[-2]  the layout of a record, a string of 'p' (pointer) and 'i' (int) per
+ *            field; the hash of a flat string, once known; the new address once
+ *            the object is copied
+ *   obj[-1]  the size of the object in words, shifted left by 2, or'ed with its kind
+ */
 
-int *initArray(int size, int init)
-{int i;
- int *a = (int *)malloc(size*sizeof(int));
- for(i=0;i<size;i++) a[i]=init;
- return a;
+typedef long word;  /* an int or a pointer of Tiger, as wide as both */
+
+struct string {int length; unsigned char chars[1];};
+
+/* A string that is a slice of a flat one, see Strings below */
+struct view {struct string *buffer; word offset, length, hash;};
+
+static struct {int length; unsigned char chars[5];} view_layout = {4, "piii"};
+static struct string builder_mark;
+
+#define SLICE_RATIO 8   /* a view of at most 1/8 of its buffer is copied by the collector */
+
+enum {K_RECORD, K_POINTERS, K_DATA, K_FORWARD};
+
+#define HEADER 2
+#define PAGE_WORDS 1024
+#define PAGE_BYTES (PAGE_WORDS * sizeof(word))
+#define DEFAULT_HEAP_MB 64
+#define MIN_COLLECT_PAGES 256
+
+static word *heap_base, *heap_end;
+static int n_pages;
+static int *page_space;     /* space the page belongs to, 0 if free */
+static int *page_run;       /* pages in the run it starts; -k if k pages after the start of one */
+static int *page_end;       /* words in use, counted from the start of its run */
+static char *page_fresh;    /* 1 while the page was never used, so that its words are zero */
+
+word *hp, *hlimit;          /* allocation pointer and end of the current page */
+static word *alloc_from;    /* hp when the allocated bytes were last counted */
+static int alloc_page = -1;
+static int alloc_fresh;     /* whether the current page was fresh when taken */
+static int took_fresh;      /* whether the run takePages returned last was all fresh */
+static int space = 1;
+static int pages_used, collect_at, next_free;
+static word *stack_bottom;
+
+static int collecting, *queue, n_queued;
+
+static struct {
+    int collections;
+    long bytes_allocated, bytes_copied, bytes_promoted;
+    double pause_total, pause_max;
+} gc_stats;
+
+/*
+ * Profiling
+ *
+ * A runtime compiled with -DTIGER_PROFILE counts the calls of the builtins and
+ * the bytes they allocate, or print, and the objects and bytes allocated at each
+ * site of the program, which tiger -profile passes to allocRecord and initArray
+ * as its line << 12 | column. Both are reported on stderr at exit. Without it,
+ * the counting compiles to nothing and the builtins take no site.
+ */
+
+#ifdef TIGER_PROFILE
+
+enum {P_ALLOC_RECORD, P_INIT_ARRAY, P_CONCAT, P_SUBSTRING, P_PRINT, P_PRINTI, P_READ, P_BUILTINS};
+
+static const char *prof_names[P_BUILTINS] = {
+    "allocRecord", "initArray", "concat", "substring", "print", "printi", "readline/readbytes"
+};
+
+static struct {long calls, bytes;} prof[P_BUILTINS];
+static int prof_current;    /* the builtin running, which allocObject charges */
+
+#define PROF_SITES 4096     /* a power of 2; the sites beyond are counted together */
+
+struct prof_site {int site; long objects, bytes;};
+static struct prof_site prof_sites[PROF_SITES], prof_other;
+
+static void profileSite(int site, long bytes)
+{
+    struct prof_site *p = &prof_other;
+    for (unsigned k = 0, h = (unsigned) site * 2654435761u; k < PROF_SITES; k++) {
+        struct prof_site *q = &prof_sites[(h + k) & (PROF_SITES - 1)];
+        if (q->objects == 0 || q->site == site) {
+            p = q;
+            break;
+        }
+    }
+    p->site = site;
+    p->objects++;
+    p->bytes += bytes;
 }
 
-int *allocRecord(int size)
-{int i;
- int *p, *a;
- p = a = (int *)malloc(size);
- for(i=0;i<size;i+=sizeof(int)) *p++ = 0;
+static int byBytes(const void *a, const void *b)
+{
+    long x = ((const struct prof_site *) a)->bytes, y = ((const struct prof_site *) b)->bytes;
+    return (x < y) - (x > y);
+}
+
+static void profileReport(void)
+{
+    int n = 0;
+    fprintf(stderr, "profile: %-20s %12s %14s\n", "builtin", "calls", "bytes");
+    for (int b = 0; b < P_BUILTINS; b++)
+        fprintf(stderr, "profile: %-20s %12ld %14ld\n", prof_names[b], prof[b].calls, prof[b].bytes);
+    for (int i = 0; i < PROF_SITES; i++)
+        if (prof_sites[i].objects) prof_sites[n++] = prof_sites[i];
+    qsort(prof_sites, n, sizeof(prof_sites[0]), byBytes);
+    fprintf(stderr, "profile: %-20s %12s %14s\n", "site", "objects", "bytes");
+    for (int i = 0; i < n; i++) {
+        char at[24];
+        sprintf(at, "%d.%d", prof_sites[i].site >> 12, prof_sites[i].site & 4095);
+        fprintf(stderr, "profile: %-20s %12ld %14ld\n", at, prof_sites[i].objects, prof_sites[i].bytes);
+    }
+    if (prof_other.objects)
+        fprintf(stderr, "profile: %-20s %12ld %14ld\n", "other", prof_other.objects, prof_other.bytes);
+}
+
+#define PROFILE(b) (prof_current = (b), prof[b].calls++)
+#define PROFILE_RESUME(b) (prof_current = (b))   /* charge b again after it called another builtin */
+#define PROFILE_BYTES(n) (prof[prof_current].bytes += (n))
+#define PROFILE_SITE(site, bytes) profileSite(site, bytes)
+#define SITE_PARAM , int site
+
+#else
+
+#define PROFILE(b) ((void) 0)
+#define PROFILE_RESUME(b) ((void) 0)
+#define PROFILE_BYTES(n) ((void) 0)
+#define PROFILE_SITE(site, bytes) ((void) 0)
+#define SITE_PARAM
+
+#endif
+
+static void heapInit(void)
+{
+    char *mb = getenv("TIGER_HEAP_MB");
+    long bytes = (long) (mb && atoi(mb) > 0 ? atoi(mb) : DEFAULT_HEAP_MB) << 20;
+    n_pages = bytes / PAGE_BYTES;
+    heap_base = (word *) calloc(n_pages, PAGE_BYTES);
+    page_space = (int *) calloc(n_pages, sizeof(int));
+    page_run = (int *) calloc(n_pages, sizeof(int));
+    page_end = (int *) calloc(n_pages, sizeof(int));
+    page_fresh = (char *) malloc(n_pages);
+    queue = (int *) malloc(n_pages * sizeof(int));
+    if (!heap_base || !page_space || !page_run || !page_end || !page_fresh || !queue) {
+        fprintf(stderr, "cannot allocate a heap of %ld bytes\n", bytes);
+        exit(1);
+    }
+    heap_end = heap_base + (long) n_pages * PAGE_WORDS;
+    memset(page_fresh, 1, n_pages);
+    collect_at = MIN_COLLECT_PAGES < n_pages / 2 ? MIN_COLLECT_PAGES : n_pages / 2;
+}
+
+static word *pageStart(int i)
+{
+    return heap_base + (long) i * PAGE_WORDS;
+}
+
+/* The first page of the run holding the object w points into, or -1 if not in use */
+static int pageOf(word w)
+{
+    word *p = (word *) w;
+    if (p < heap_base || p >= heap_end) return -1;
+    int i = (p - heap_base) / PAGE_WORDS;
+    if (!page_space[i]) return -1;
+    return page_run[i] < 0 ? i + page_run[i] : i;
+}
+
+/* Count what was bumped into the current page since last time, by the runtime or in line */
+static void countAllocated(void)
+{
+    if (alloc_page >= 0 && !collecting) gc_stats.bytes_allocated += (hp - alloc_from) * sizeof(word);
+    alloc_from = hp;
+}
+
+/* Close the current page, so that the next allocation takes a new one */
+static void closePage(void)
+{
+    countAllocated();
+    if (alloc_page >= 0) page_end[alloc_page] = hp - pageStart(alloc_page);
+    alloc_page = -1;
+    hp = hlimit = NULL;
+}
+
+static void collect(void);
+
+/* Take a run of k free pages for the current space, collecting first if it is time */
+static int takePages(int k)
+{
+    if (!collecting && pages_used + k > collect_at) {
+        collect();
+    }
+    for (int tries = 0; tries < 2; tries++) {
+        int run = 0;
+        for (int i = next_free; i < n_pages; i++) {
+            run = page_space[i] ? 0 : run + 1;
+            if (run == k) {
+                int first = i - k + 1;
+                took_fresh = 1;
+                for (int j = 0; j < k; j++) {
+                    page_space[first + j] = space;
+                    page_run[first + j] = j ? -j : k;
+                    took_fresh &= page_fresh[first + j];
+                    page_fresh[first + j] = 0;
+                }
+                page_end[first] = 0;
+                pages_used += k;
+                next_free = k == 1 ? i + 1 : next_free;
+                if (collecting) {
+                    queue[n_queued++] = first;
+                }
+                return first;
+            }
+        }
+        next_free = 0;
+    }
+    fprintf(stderr, "out of memory: heap of %d pages is full\n", n_pages);
+    exit(1);
+}
+
+/* An object of the kind with words of payload, zeroed if zero and its page was used before */
+static word *allocObject(int words, int kind, struct string *layout, int zero)
+{
+    word *obj;
+    int total = words + HEADER, fresh;
+    if (total > PAGE_WORDS) {
+        closePage();
+        int first = takePages((total + PAGE_WORDS - 1) / PAGE_WORDS);
+        fresh = took_fresh;
+        obj = pageStart(first) + HEADER;
+        page_end[first] = total;
+        if (!collecting) gc_stats.bytes_allocated += total * sizeof(word);
+    } else {
+        if (hp + total > hlimit) {
+            closePage();
+            alloc_page = takePages(1);
+            alloc_fresh = took_fresh;
+            hp = alloc_from = pageStart(alloc_page);
+            hlimit = hp + PAGE_WORDS;
+        }
+        fresh = alloc_fresh;
+        obj = hp + HEADER;
+        hp += total;
+    }
+    obj[-2] = (word) layout;
+    obj[-1] = ((word) words << 2) | kind;
+    if (zero && !fresh) memset(obj, 0, words * sizeof(word));
+    if (!collecting) PROFILE_BYTES(total * sizeof(word));
+    return obj;
+}
+
+/*
+ * Collection
+ */
+
+static int from_space;
+
+/* Move the run w points into, if any, from the old space to the new one, keeping its objects */
+static void promote(word w)
+{
+    int i = pageOf(w);
+    if (i < 0 || page_space[i] != from_space) return;
+    if (alloc_page >= 0) closePage();
+    for (int j = 0; j < page_run[i]; j++) {
+        page_space[i + j] = space;
+    }
+    queue[n_queued++] = i;
+    gc_stats.bytes_promoted += (long) page_run[i] * PAGE_BYTES;
+}
+
+static void scanRange(word *lo, word *hi)
+{
+    for (; lo < hi; lo++) {
+        promote(*lo);
+    }
+}
+
+/* Keeps its frame below the one holding the registers saved by setjmp */
+static void scanStack(void)
+{
+    word top;
+    scanRange(&top, stack_bottom);
+}
+
+/* Copy the object pointed to by *field to the new space, or promote its run if large */
+static void forward(word *field)
+{
+    int i = pageOf(*field);
+    if (i < 0 || page_space[i] != from_space) return;
+    word *obj = (word *) *field;
+    if ((obj[-1] & 3) == K_FORWARD) {
+        *field = obj[-2];
+        return;
+    }
+    int words = obj[-1] >> 2;
+    if (words + HEADER > PAGE_WORDS) {
+        promote(*field);
+        return;
+    }
+    word *copy = allocObject(words, obj[-1] & 3, (struct string *) obj[-2], 0);
+    memcpy(copy, obj, words * sizeof(word));
+    gc_stats.bytes_copied += (words + HEADER) * sizeof(word);
+    obj[-2] = (word) copy;
+    obj[-1] = K_FORWARD;
+    *field = (word) copy;
+}
+
+static void scanView(word *obj);
+
+static void scanObject(word *obj)
+{
+    int words = obj[-1] >> 2;
+    switch (obj[-1] & 3) {
+        case K_RECORD: {
+            struct string *layout = (struct string *) obj[-2];
+            if (layout == (struct string *) &view_layout) {
+                scanView(obj);
+                break;
+            }
+            for (int k = 0; k < words && k < layout->length; k++) {
+                if (layout->chars[k] == 'p') forward(obj + k);
+            }
+            break;
+        }
+        case K_POINTERS:
+            for (int k = 0; k < words; k++) {
+                forward(obj + k);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void collect(void)
+{
+    clock_t start = clock();
+    jmp_buf regs;
+
+    collecting = 1;
+    from_space = space++;
+    closePage();
+    n_queued = 0;
+
+    /* Promote what the registers and the stack may point to */
+    setjmp(regs);
+    scanRange((word *) &regs, (word *) (&regs + 1));
+    scanStack();
+
+    /* Scan the queued runs in order, each up to its end, which moves while it is being filled */
+    for (int q = 0; q < n_queued; q++) {
+        int i = queue[q];
+        word *base = pageStart(i);
+        for (int pos = 0;;) {
+            int end = i == alloc_page ? hp - base : page_end[i];
+            if (pos >= end) break;
+            word *obj = base + pos + HEADER;
+            scanObject(obj);
+            pos += HEADER + (obj[-1] >> 2);
+        }
+    }
+
+    /* The old space is free */
+    pages_used = 0;
+    for (int i = 0; i < n_pages; i++) {
+        if (page_space[i] == from_space) page_space[i] = 0;
+        else if (page_space[i]) pages_used++;
+    }
+    next_free = 0;
+    collect_at = 2 * pages_used > MIN_COLLECT_PAGES ? 2 * pages_used : MIN_COLLECT_PAGES;
+    if (collect_at > n_pages / 2 && pages_used < n_pages / 2) collect_at = n_pages / 2;
+    if (collect_at < pages_used + 1) collect_at = n_pages;
+
+    /* The page copied into last is left behind by the allocation that collected, so it gets its end */
+    closePage();
+    collecting = 0;
+
+    double pause = (double) (clock() - start) / CLOCKS_PER_SEC;
+    gc_stats.collections++;
+    gc_stats.pause_total += pause;
+    if (pause > gc_stats.pause_max) gc_stats.pause_max = pause;
+}
+
+static void gcReport(void)
+{
+    countAllocated();
+    fprintf(stderr, "gc: %d collections, %ld bytes allocated, %ld copied, %ld promoted in place\n",
+            gc_stats.collections, gc_stats.bytes_allocated, gc_stats.bytes_copied, gc_stats.bytes_promoted);
+    fprintf(stderr, "gc: pauses %.3fs in total, %.3fs at most, %d of %d pages in use\n",
+            gc_stats.pause_total, gc_stats.pause_max, pages_used, n_pages);
+}
+
+/*
+ * Strings
+ *
+ * A string is flat, its length followed by its bytes as literals and the strings of
+ * chr are, or a view of length bytes at offset in a flat buffer of the heap. Views
+ * are records, which is how they are told from flat strings, so the collector moves
+ * a buffer along with its views.
+ *
+ * concat makes a buffer with room for as much again, and appends in place when its
+ * left operand is a view that ends where its buffer is filled up to: a loop of
+ * s := concat(s, x) then grows one buffer, doubled when full, in amortized O(1) per
+ * append. The bytes a view has are never changed, so a view that no longer ends at
+ * the end of its buffer is copied from instead. Such buffers are marked in the
+ * layout word of their header, as the other flat strings may be seen by Tiger code
+ * and must keep their length.
+ *
+ * substring returns a view sharing the bytes of its operand, unless a copy would
+ * be no larger than the view. A view much smaller than its buffer is copied by the
+ * collector instead, if nothing has reached the buffer before it, so that a token
+ * does not keep the whole input alive.
+ */
+
+static struct string *allocString(int n)
+{
+    int words = (sizeof(int) + n + sizeof(word) - 1) / sizeof(word);
+    struct string *s = (struct string *) allocObject(words, K_DATA, NULL, 0);
+    s->length = n;
+    return s;
+}
+
+static int isView(struct string *s)
+{
+    return pageOf((word) s) >= 0 && (((word *) s)[-1] & 3) == K_RECORD;
+}
+
+static int isBuilder(struct string *s)
+{
+    return pageOf((word) s) >= 0 && ((word *) s)[-2] == (word) &builder_mark;
+}
+
+/* The bytes of s, and their number in *n */
+static unsigned char *bytesOf(struct string *s, int *n)
+{
+    if (isView(s)) {
+        struct view *v = (struct view *) s;
+        *n = v->length;
+        return v->buffer->chars + v->offset;
+    }
+    *n = s->length;
+    return s->chars;
+}
+
+/* Bytes a flat string of the heap has room for */
+static int capacity(struct string *buffer)
+{
+    return (((word *) buffer)[-1] >> 2) * sizeof(word) - sizeof(int);
+}
+
+static struct string *newView(struct string *buffer, int offset, int length)
+{
+    struct view *v = (struct view *) allocObject(sizeof(struct view) / sizeof(word), K_RECORD,
+                                                 (struct string *) &view_layout, 0);
+    v->buffer = buffer;
+    v->offset = offset;
+    v->length = length;
+    v->hash = 0;
+    return (struct string *) v;
+}
+
+/* Copy the bytes of a view that is small beside a buffer still in the old space, or forward the buffer */
+static void scanView(word *obj)
+{
+    struct view *v = (struct view *) obj;
+    word *buffer = (word *) v->buffer;
+    int i = pageOf((word) buffer);
+    if (i >= 0 && page_space[i] == from_space && (buffer[-1] & 3) != K_FORWARD
+        && (long) v->length * SLICE_RATIO <= capacity(v->buffer)) {
+        struct string *copy = allocString(v->length);
+        memcpy(copy->chars, v->buffer->chars + v->offset, v->length);
+        v->buffer = copy;
+        v->offset = 0;
+        gc_stats.bytes_copied += v->length;
+        return;
+    }
+    forward((word *) &v->buffer);
+}
+
+/*
+ * An array of size words, all init. Its length is in its header. Zeros come from
+ * fresh pages or one memset; other values are stored four at a time, which the C
+ * compiler turns into vector stores where the machine has them.
+ */
+word *initArray(int size, word init, int pointers SITE_PARAM)
+{
+ word *a;
+ int i = 0;
+ PROFILE(P_INIT_ARRAY);
+ PROFILE_SITE(site, (size + HEADER) * sizeof(word));
+ a = allocObject(size, pointers ? K_POINTERS : K_DATA, NULL, init == 0);
+ if (init != 0) {
+   for (; i + 4 <= size; i += 4) {
+     a[i] = init; a[i + 1] = init; a[i + 2] = init; a[i + 3] = init;
+   }
+   for (; i < size; i++) a[i] = init;
+ }
  return a;
 }
 
-struct string {int length; unsigned char chars[1];};
+word *allocRecord(int size, struct string *layout SITE_PARAM)
+{
+ PROFILE(P_ALLOC_RECORD);
+ PROFILE_SITE(site, size + HEADER * sizeof(word));
+ return allocObject(size / sizeof(word), K_RECORD, layout, 1);
+}
+
+/* The word a hash of s is kept in, or NULL for the literals and chr's strings outside the heap */
+static word *hashSlot(struct string *s)
+{
+    if (pageOf((word) s) < 0) return NULL;
+    if (isView(s)) return &((struct view *) s)->hash;
+    return isBuilder(s) ? NULL : &((word *) s)[-2];
+}
 
+/*
+ * FNV-1a of the bytes of s, kept odd in its slot so that it is never taken for
+ * an empty slot, a layout or the builder mark
+ */
+static word hashOf(struct string *s, word *slot)
+{
+    if (*slot) return *slot;
+    int n;
+    unsigned char *p = bytesOf(s, &n);
+    unsigned h = 2166136261u;
+    for (int i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+    return *slot = ((word) h << 1) | 1;
+}
+
+/* Compare n bytes a word at a time, then bytewise within the first word that differs */
+static int compareBytes(const unsigned char *p, const unsigned char *q, int n)
+{
+    unsigned long long a, b;
+    for (; n >= (int) sizeof(a); n -= sizeof(a), p += sizeof(a), q += sizeof(a)) {
+        memcpy(&a, p, sizeof(a));
+        memcpy(&b, q, sizeof(b));
+        if (a != b) break;
+    }
+    for (; n > 0; n--, p++, q++)
+        if (*p != *q) return *p - *q;
+    return 0;
+}
+
+#define HASH_MIN 16 /* strings shorter than this are compared rather than hashed */
+
+/*
+ * Equal strings of the heap of at least HASH_MIN bytes get a hash the first time
+ * they are compared, so that a string compared over and over, as a key searched
+ * for in a list is, is told from the others of its length by the hash alone.
+ * Literals are interned by the compiler and found equal by their address.
+ */
 int stringEqual(struct string *s, struct string *t)
-{int i;
+{int ns, nt;
+ unsigned char *p, *q;
+ word *hs, *ht;
  if (s==t) return 1;
- if (s->length!=t->length) return 0;
- for(i=0;i<s->length;i++) if (s->chars[i]!=t->chars[i]) return 0;
- return 1;
+ p=bytesOf(s,&ns); q=bytesOf(t,&nt);
+ if (ns!=nt) return 0;
+ if (ns>=HASH_MIN && (hs=hashSlot(s)) && (ht=hashSlot(t)) && hashOf(s,hs)!=hashOf(t,ht)) return 0;
+ return compareBytes(p,q,ns)==0;
+}
+
+/* Negative, zero or positive as s sorts before, with or after t */
+int strCmp(struct string *s, struct string *t)
+{int ns, nt, c;
+ unsigned char *p, *q;
+ if (s==t) return 0;
+ p=bytesOf(s,&ns); q=bytesOf(t,&nt);
+ c=compareBytes(p,q,ns<nt ? ns : nt);
+ return c ? c : ns-nt;
+}
+
+/*
+ * Output
+ *
+ * print copies whole strings into a buffer of the runtime, written to stdout when
+ * it fills, on flush, before input is read, before an error is reported and at
+ * exit. A string no smaller than the buffer is written directly.
+ */
+
+#define OUT_BYTES 65536
+
+static unsigned char out_buf[OUT_BYTES];
+static int out_n;
+
+static struct {
+    long bytes_read, bytes_written;
+} io_stats;
+
+static void outFlush(void)
+{
+    if (out_n) fwrite(out_buf, 1, out_n, stdout);
+    out_n = 0;
+    fflush(stdout);
+}
+
+static void outWrite(const unsigned char *p, int n)
+{
+    io_stats.bytes_written += n;
+    if (out_n + n > OUT_BYTES) {
+        outFlush();
+        if (n >= OUT_BYTES) {
+            fwrite(p, 1, n, stdout);
+            return;
+        }
+    }
+    memcpy(out_buf + out_n, p, n);
+    out_n += n;
+}
+
+static void ioReport(void)
+{
+    double t = (double) clock() / CLOCKS_PER_SEC;
+    fprintf(stderr, "io: %ld bytes read, %ld written in %.3fs, %.1f MB/s in, %.1f MB/s out\n",
+            io_stats.bytes_read, io_stats.bytes_written, t,
+            t > 0 ? io_stats.bytes_read / t / 1e6 : 0.0, t > 0 ? io_stats.bytes_written / t / 1e6 : 0.0);
 }
 
 void print(struct string *s)
-{int i; unsigned char *p=s->chars;
- for(i=0;i<s->length;i++,p++) putchar(*p);
+{int n; unsigned char *p=bytesOf(s,&n);
+ PROFILE(P_PRINT);
+ PROFILE_BYTES(n);
+ outWrite(p,n);
+}
+
+/* The decimal digits of i, with a minus sign if negative */
+void printi(int i)
+{unsigned char digits[12], *p=digits+sizeof(digits);
+ unsigned u = i<0 ? -(unsigned)i : (unsigned)i;
+ do *--p = '0' + u%10; while (u/=10);
+ if (i<0) *--p = '-';
+ PROFILE(P_PRINTI);
+ PROFILE_BYTES(digits+sizeof(digits)-p);
+ outWrite(p, digits+sizeof(digits)-p);
 }
 
 void flush()
 {
- fflush(stdout);
+ outFlush();
 }
 
 struct string consts[256];
 struct string empty={0,""};
 
+/* frame pointers by nesting depth, used when the compiler emits a display */
+int *display[64];
+
 int main()
 {int i;
+ word bottom;
  for(i=0;i<256;i++)
    {consts[i].length=1;
     consts[i].chars[0]=i;
    }
+ stack_bottom = &bottom;
+ heapInit();
+ if (getenv("TIGER_GC_STATS")) atexit(gcReport);
+ if (getenv("TIGER_IO_STATS")) atexit(ioReport);
+#ifdef TIGER_PROFILE
+ atexit(profileReport);
+#endif
+ atexit(outFlush);
  return tigermain(0 /* static link */);
 }
 
 int ord(struct string *s)
-{
- if (s->length==0) return -1;
- else return s->chars[0];
+{int n; unsigned char *p=bytesOf(s,&n);
+ if (n==0) return -1;
+ else return p[0];
 }
 
 struct string *chr(int i)
 {
- if (i<0 || i>=256) 
-   {printf("chr(%d) out of range\n",i); exit(1);}
+ if (i<0 || i>=256)
+   {outFlush(); printf("chr(%d) out of range\n",i); exit(1);}
  return consts+i;
 }
 
 int size(struct string *s)
-{ 
- return s->length;
+{int n;
+ bytesOf(s,&n);
+ return n;
 }
 
 struct string *substring(struct string *s, int first, int n)
-{
- if (first<0 || first+n>s->length)
-   {printf("substring([%d],%d,%d) out of range\n",s->length,first,n);
+{int length; unsigned char *p=bytesOf(s,&length);
+ PROFILE(P_SUBSTRING);
+ if (first<0 || first+n>length)
+   {outFlush();
+    printf("substring([%d],%d,%d) out of range\n",length,first,n);
     exit(1);}
- if (n==1) return consts+s->chars[first];
- {struct string *t = (struct string *)malloc(sizeof(int)+n);
-  int i;
-  t->length=n;
-  for(i=0;i<n;i++) t->chars[i]=s->chars[first+i];
+ if (n==0) return &empty;
+ if (n==1) return consts+p[first];
+ {struct string *buffer = s;
+  int offset = first;
+  if (isView(s)) {
+    buffer = ((struct view *) s)->buffer;
+    offset += ((struct view *) s)->offset;
+  }
+  if (sizeof(int) + n > sizeof(struct view))
+    return newView(buffer, offset, n);
+ }
+ {struct string *t;
+  t = allocString(n);
+  p = bytesOf(s,&length);
+  memcpy(t->chars, p+first, n);
   return t;
  }
 }
 
 struct string *concat(struct string *a, struct string *b)
-{
- if (a->length==0) return b;
- else if (b->length==0) return a;
- else {int i, n=a->length+b->length;
-       struct string *t = (struct string *)malloc(sizeof(int)+n);
-       t->length=n;
-       for (i=0;i<a->length;i++)
-	 t->chars[i]=a->chars[i];
-       for(i=0;i<b->length;i++)
-	 t->chars[i+a->length]=b->chars[i];
-       return t;
-     }
+{int na, nb;
+ unsigned char *pa=bytesOf(a,&na), *pb=bytesOf(b,&nb);
+ PROFILE(P_CONCAT);
+ if (na==0) return b;
+ else if (nb==0) return a;
+ if (isView(a)) {
+   struct view *v = (struct view *) a;
+   struct string *buffer = v->buffer;
+   if (isBuilder(buffer) && v->offset + na == buffer->length && buffer->length + nb <= capacity(buffer)) {
+     struct string *t = newView(buffer, v->offset, na + nb);
+     pb = bytesOf(b,&nb);
+     memcpy(buffer->chars + buffer->length, pb, nb);
+     buffer->length += nb;
+     return t;
+   }
+ }
+ {struct string *buffer = allocString(2 * (na + nb));
+  ((word *) buffer)[-2] = (word) &builder_mark;
+  pa = bytesOf(a,&na); pb = bytesOf(b,&nb);
+  memcpy(buffer->chars, pa, na);
+  memcpy(buffer->chars + na, pb, nb);
+  buffer->length = na + nb;
+  return newView(buffer, 0, na + nb);
+ }
 }
 
 int not(int i)
@@ -102,8 +772,72 @@ int not(int i)
 
 #undef getchar
 
+/*
+ * Input
+ *
+ * stdin is read in blocks of up to IN_BYTES into a buffer that getchar, readline
+ * and readbytes take their bytes from. A read waits only for the bytes already
+ * available, as a terminal gives a line, and writes the output buffer out first
+ * so that a prompt is seen before the program waits.
+ */
+
+#define IN_BYTES 65536
+
+static unsigned char in_buf[IN_BYTES];
+static int in_pos, in_n;
+
+/* Read the next block of input, and return 0 at its end */
+static int inFill(void)
+{
+    if (out_n) outFlush();
+    in_pos = 0;
+    do in_n = read(0, in_buf, IN_BYTES); while (in_n < 0 && errno == EINTR);
+    if (in_n < 0) in_n = 0;
+    io_stats.bytes_read += in_n;
+    return in_n;
+}
+
 struct string *getchar()
-{int i=getc(stdin);
- if (i==EOF) return &empty;
- else return consts+i;
+{
+ if (in_pos < in_n || inFill()) return consts+in_buf[in_pos++];
+ return &empty;
+}
+
+/* Bytes of input up to and including the first of stop, or n of them if there is none, as one string */
+static struct string *readUntil(int stop, int n)
+{struct string *s = &empty;
+ int found = 0;
+ while (!found && n > 0 && (in_pos < in_n || inFill())) {
+   unsigned char *p = in_buf+in_pos, *e;
+   int k = in_n-in_pos < n ? in_n-in_pos : n;
+   if (stop >= 0 && (e = memchr(p, stop, k))) {
+     k = e+1-p;
+     found = 1;
+   }
+   {struct string *t = allocString(k);
+    memcpy(t->chars, p, k);
+    in_pos += k;
+    n -= k;
+    if (s==&empty) s = t;
+    else {
+      s = concat(s, t);
+      PROFILE_RESUME(P_READ);
+    }
+   }
+ }
+ return s;
+}
+
+/* The next line of input with its newline, the rest of the input if it has none, or "" at its end */
+struct string *readline()
+{
+ PROFILE(P_READ);
+ return readUntil('\n', INT_MAX);
+}
+
+/* The next n bytes of input, or as many as are left */
+struct string *readbytes(int n)
+{
+ PROFILE(P_READ);
+ return readUntil(-1, n);
 }
@@ -0,0 +1,62 @@
+/*
+ * gctest.c - regression tests of the collector, run on the host against runtime.c
+ *
+ * usage: cc -o gctest tests/gctest.c && ./gctest
+ *
+ * The runtime is included whole, so that the tests see its statistics; this file
+ * stands for the Tiger program and provides tigermain. Each test prints ok or
+ * FAIL, and the exit status is the number of failures.
+ */
+
+#define TIGER_HOST
+#define getchar tiger_getchar   /* stdio's getchar, so that the runtime's can take its name */
+#include <stdio.h>
+#include "../runtime.c"
+
+static struct {int length; unsigned char chars[2];} node_layout = {2, "pi"};
+
+/* A record of the layout {next, value}, as tiger compiles one */
+static word *node(word *next, word value)
+{
+    word *r = allocRecord(2 * sizeof(word), (struct string *) &node_layout);
+    r[0] = (word) next;
+    r[1] = value;
+    return r;
+}
+
+/* Allocate garbage until the collector has run n times in all, then fill the pages it freed */
+static void collectUntil(int n)
+{
+    while (gc_stats.collections < n) node(NULL, 0xabab);
+    for (int i = 0; i < PAGE_WORDS / 4 * MIN_COLLECT_PAGES; i++) node(NULL, 0xabab);
+}
+
+/*
+ * A collection started from takePages left the last page it copied into without
+ * its end, so a later collection that promoted the page scanned none of its
+ * objects and freed what only they pointed to.
+ */
+static int testCopiedPageKeepsItsEnd(void)
+{
+    word *list = NULL;
+    int first = gc_stats.collections;
+    for (int i = 0; gc_stats.collections == first; i++) list = node(list, i);
+
+    /* The oldest node was copied last, so it is on the last page of the collection */
+    word *last = list;
+    while (last[0]) last = (word *) last[0];
+    last[0] = (word) node(NULL, 309);
+    list = NULL;
+
+    collectUntil(gc_stats.collections + 1);
+    word value = ((word *) last[0])[1];
+    printf("%s copied page keeps its end: %ld\n", value == 309 ? "ok" : "FAIL", value);
+    return value != 309;
+}
+
+int tigermain(int static_link)
+{
+    int failures = 0;
+    failures += testCopiedPageKeepsItsEnd();
+    return failures;
+}